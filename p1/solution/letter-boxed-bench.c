@@ -0,0 +1,382 @@
+// Micro-benchmarks for letter-boxed, run with `make bench`
+// Usage: ./letter-boxed-bench <dictionary_file> [board_file]
+//        ./letter-boxed-bench --report
+//
+// --report (`make bench-report`) generates synthetic boards with 3 to 8 sides,
+// each with a large synthetic dictionary and solution, and prints one
+// tab-separated row of timings per board.
+
+#define LETTER_BOXED_NO_MAIN
+#include "letter-boxed.c"
+
+#define LOOKUP_ROUNDS 20
+#define CHECK_ROUNDS 20
+#define COMPILED_BENCH_FILE "letter-boxed-bench.lbx"
+#define REPORT_MIN_SIDES 3
+#define REPORT_MAX_SIDES 8
+#define REPORT_LETTERS_PER_SIDE 3
+#define REPORT_DICT_WORDS 200000
+#define REPORT_SOLUTION_WORDS 20000
+#define REPORT_MAX_WORD_LENGTH 12
+#define REPORT_REPEATS 3
+#define REPORT_SEED 537
+
+// The per-word board checks as they were before the board was compiled, kept
+// as a baseline: strchr over every side for every letter, strlen per iteration
+int legacy_letter_on_board(char letter, char **board, int num_sides) {
+    for (int i = 0; i < num_sides; i++) {
+        if (strchr(board[i], letter)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int legacy_get_side_of_letter(char letter, char **board, int num_sides) {
+    for (int i = 0; i < num_sides; i++) {
+        if (strchr(board[i], letter)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Verdict legacy_check_word(char **board, int num_sides, const char *word, char prev_last_char,
+                          int used_letters[ALPHABET_SIZE]) {
+    int side_used = -1;
+    for (size_t i = 0; i < strlen(word); i++) {
+        if (!legacy_letter_on_board(word[i], board, num_sides)) {
+            return LETTER_NOT_ON_BOARD;
+        }
+    }
+    if (prev_last_char != '\0' && word[0] != prev_last_char) {
+        return FIRST_LETTER_MISMATCH;
+    }
+    for (size_t i = 0; i < strlen(word); i++) {
+        int current_side = legacy_get_side_of_letter(word[i], board, num_sides);
+        if (side_used != -1 && current_side == side_used) {
+            return SAME_SIDE_CONSECUTIVE;
+        }
+        used_letters[word[i] - 'a'] = 1;
+        side_used = current_side;
+    }
+    return CORRECT;
+}
+
+// Dictionary membership lookups/sec: every dictionary word (hits) plus the
+// same words with their last letter changed (mostly misses)
+void bench_lookup(const Dictionary *dict, const char *label) {
+    char **misses = malloc(dict->size * sizeof(char *));
+    if (misses == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    for (int i = 0; i < dict->size; i++) {
+        misses[i] = string_duplicate(dictionary_word(dict, i));
+        size_t len = strlen(misses[i]);
+        if (len > 0) {
+            misses[i][len - 1] = 'a' + (misses[i][len - 1] - 'a' + 13) % ALPHABET_SIZE;
+        }
+    }
+
+    long lookups = 0;
+    long found = 0;
+    double start = now_seconds();
+    for (int round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (int i = 0; i < dict->size; i++) {
+            found += word_in_dictionary(dictionary_word(dict, i), dict);
+            found += word_in_dictionary(misses[i], dict);
+            lookups += 2;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("lookup %s: %ld lookups (%ld found) in %.3f s, %.0f lookups/sec\n",
+           label, lookups, found, elapsed, lookups / elapsed);
+
+    for (int i = 0; i < dict->size; i++) {
+        free(misses[i]);
+    }
+    free(misses);
+}
+
+// Per-word board check cost, legacy strchr scans vs the compiled board
+void bench_check(char **board, int num_sides, const Dictionary *dict, const char *label) {
+    CompiledBoard compiled;
+    compile_board(board, num_sides, &compiled);
+
+    long checks = 0;
+    long legacy_ok = 0;
+    double start = now_seconds();
+    for (int round = 0; round < CHECK_ROUNDS; round++) {
+        for (int i = 0; i < dict->size; i++) {
+            int used_letters[ALPHABET_SIZE] = {0};
+            legacy_ok += legacy_check_word(board, num_sides, dictionary_word(dict, i), '\0', used_letters) == CORRECT;
+            checks++;
+        }
+    }
+    double legacy = now_seconds() - start;
+
+    long compiled_ok = 0;
+    start = now_seconds();
+    for (int round = 0; round < CHECK_ROUNDS; round++) {
+        for (int i = 0; i < dict->size; i++) {
+            uint32_t used = 0;
+            size_t length;
+            compiled_ok += check_word(&compiled, dictionary_word(dict, i), '\0', &used, &length) == CORRECT;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("check %s: %ld words, legacy %.1f ns/word (%ld ok), compiled %.1f ns/word (%ld ok), %.1fx\n",
+           label, checks, legacy / checks * 1e9, legacy_ok, elapsed / checks * 1e9, compiled_ok, legacy / elapsed);
+}
+
+// xorshift64* so the synthetic inputs are identical on every run
+uint64_t bench_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1du;
+}
+
+// Create a temporary file for synthetic input, returns its fd
+int bench_temp_file(char *path) {
+    strcpy(path, "/tmp/letter-boxed-bench-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Error: Could not create temporary file.\n");
+        exit(1);
+    }
+    return fd;
+}
+
+// A random word that is playable on the board: a walk that changes side on
+// every letter, starting from `first` (or anywhere if it is '\0')
+void random_playable_word(char **board, int num_sides, char first, int length, uint64_t *rng, char *word) {
+    int side = -1;
+    if (first != '\0') {
+        for (int i = 0; i < num_sides; i++) {
+            if (strchr(board[i], first)) {
+                side = i;
+            }
+        }
+        word[0] = first;
+    }
+    for (int i = first != '\0' ? 1 : 0; i < length; i++) {
+        int next = bench_random(rng) % (num_sides - (side >= 0 ? 1 : 0));
+        if (side >= 0 && next >= side) {
+            next++;  // skip the current side
+        }
+        side = next;
+        word[i] = board[side][bench_random(rng) % strlen(board[side])];
+    }
+    word[length] = '\0';
+}
+
+// Best of REPORT_REPEATS timings of one text, filtered or compiled load, in ms
+double time_load(const char *dict_file, const signed char *side_of) {
+    double best = 0;
+    for (int round = 0; round < REPORT_REPEATS; round++) {
+        double start = now_seconds();
+        Dictionary dict;
+        load_dictionary(dict_file, &dict, side_of);
+        double elapsed = now_seconds() - start;
+        free_board_and_dictionary(NULL, 0, &dict);
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best * 1e3;
+}
+
+// One report row: synthetic board with num_sides sides, dictionary and solution
+void report_board(int num_sides, uint64_t *rng) {
+    // Board: a shuffled alphabet dealt out REPORT_LETTERS_PER_SIDE letters per side
+    char alphabet[ALPHABET_SIZE + 1] = "abcdefghijklmnopqrstuvwxyz";
+    for (int i = ALPHABET_SIZE - 1; i > 0; i--) {
+        int j = bench_random(rng) % (i + 1);
+        char tmp = alphabet[i];
+        alphabet[i] = alphabet[j];
+        alphabet[j] = tmp;
+    }
+    char board_path[64], dict_path[64], solution_path[64];
+    FILE *board_file = fdopen(bench_temp_file(board_path), "w");
+    char **board = malloc(num_sides * sizeof(char *));
+    for (int i = 0; i < num_sides; i++) {
+        board[i] = malloc(REPORT_LETTERS_PER_SIDE + 1);
+        memcpy(board[i], alphabet + i * REPORT_LETTERS_PER_SIDE, REPORT_LETTERS_PER_SIDE);
+        board[i][REPORT_LETTERS_PER_SIDE] = '\0';
+        fprintf(board_file, "%s\n", board[i]);
+    }
+    fclose(board_file);
+
+    // Solution: a chain of playable words, which also go in the dictionary
+    FILE *dict_file = fdopen(bench_temp_file(dict_path), "w");
+    FILE *solution_file = fdopen(bench_temp_file(solution_path), "w");
+    char **solution = malloc(REPORT_SOLUTION_WORDS * sizeof(char *));
+    char last = '\0';
+    for (int i = 0; i < REPORT_SOLUTION_WORDS; i++) {
+        solution[i] = malloc(REPORT_MAX_WORD_LENGTH + 1);
+        int length = 3 + bench_random(rng) % (REPORT_MAX_WORD_LENGTH - 2);
+        random_playable_word(board, num_sides, last, length, rng, solution[i]);
+        last = solution[i][length - 1];
+        fprintf(solution_file, "%s\n", solution[i]);
+        fprintf(dict_file, "%s\n", solution[i]);
+    }
+    fclose(solution_file);
+
+    // Dictionary: the rest half playable words, half random letters
+    char word[REPORT_MAX_WORD_LENGTH + 1];
+    for (int i = REPORT_SOLUTION_WORDS; i < REPORT_DICT_WORDS; i++) {
+        int length = 3 + bench_random(rng) % (REPORT_MAX_WORD_LENGTH - 2);
+        if (i % 2 == 0) {
+            random_playable_word(board, num_sides, '\0', length, rng, word);
+        } else {
+            for (int j = 0; j < length; j++) {
+                word[j] = 'a' + bench_random(rng) % ALPHABET_SIZE;
+            }
+            word[length] = '\0';
+        }
+        fprintf(dict_file, "%s\n", word);
+    }
+    fclose(dict_file);
+
+    signed char side_of[ALPHABET_SIZE];
+    build_side_map(board, num_sides, side_of);
+    double load_ms = time_load(dict_path, NULL);
+    double filtered_load_ms = time_load(dict_path, side_of);
+
+    Dictionary dict;
+    load_dictionary(dict_path, &dict, NULL);
+    write_compiled_dictionary(&dict, COMPILED_BENCH_FILE);
+    double compiled_load_ms = time_load(COMPILED_BENCH_FILE, NULL);
+    unlink(COMPILED_BENCH_FILE);
+
+    // Per-word costs over the solution words
+    CompiledBoard compiled;
+    compile_board(board, num_sides, &compiled);
+    double check_ns = 0, lookup_ns = 0;
+    for (int round = 0; round < REPORT_REPEATS; round++) {
+        uint32_t used = 0;
+        size_t length;
+        long ok = 0;
+        double start = now_seconds();
+        for (int i = 0; i < REPORT_SOLUTION_WORDS; i++) {
+            ok += check_word(&compiled, solution[i], '\0', &used, &length) == CORRECT;
+        }
+        double check = (now_seconds() - start) / REPORT_SOLUTION_WORDS * 1e9;
+        start = now_seconds();
+        for (int i = 0; i < REPORT_SOLUTION_WORDS; i++) {
+            ok += word_in_dictionary(solution[i], &dict);
+        }
+        double lookup = (now_seconds() - start) / REPORT_SOLUTION_WORDS * 1e9;
+        if (ok != 2 * REPORT_SOLUTION_WORDS) {
+            printf("Error: Synthetic solution rejected.\n");
+            exit(1);
+        }
+        if (round == 0 || check < check_ns) {
+            check_ns = check;
+        }
+        if (round == 0 || lookup < lookup_ns) {
+            lookup_ns = lookup;
+        }
+    }
+    free_board_and_dictionary(NULL, 0, &dict);
+
+    // Full run, the same steps main() takes to check a solution
+    double full_run_ms = 0;
+    Verdict verdict = CORRECT;
+    for (int round = 0; round < REPORT_REPEATS; round++) {
+        double start = now_seconds();
+        int sides;
+        char **run_board = parse_board(board_path, &sides);
+        signed char run_side_of[ALPHABET_SIZE];
+        build_side_map(run_board, sides, run_side_of);
+        Dictionary run_dict;
+        load_dictionary(dict_path, &run_dict, run_side_of);
+        int input = open(solution_path, O_RDONLY);
+        verdict = check_solution(run_board, sides, &run_dict, input);
+        close(input);
+        free_board_and_dictionary(run_board, sides, &run_dict);
+        double elapsed = (now_seconds() - start) * 1e3;
+        if (round == 0 || elapsed < full_run_ms) {
+            full_run_ms = elapsed;
+        }
+    }
+
+    printf("%d\t%d\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.1f\t%.1f\t%.3f\t%s\n", num_sides, num_sides * REPORT_LETTERS_PER_SIDE,
+           REPORT_DICT_WORDS, REPORT_SOLUTION_WORDS, load_ms, filtered_load_ms, compiled_load_ms, check_ns, lookup_ns,
+           full_run_ms, verdict_messages[verdict]);
+
+    for (int i = 0; i < REPORT_SOLUTION_WORDS; i++) {
+        free(solution[i]);
+    }
+    free(solution);
+    free_board(board, num_sides);
+    unlink(board_path);
+    unlink(dict_path);
+    unlink(solution_path);
+}
+
+// Synthetic report, one row per board size
+void bench_report(void) {
+    uint64_t rng = REPORT_SEED;
+    printf("sides\tletters\tdict_words\tsolution_words\tload_ms\tfiltered_load_ms\tcompiled_load_ms\t"
+           "check_ns_per_word\tlookup_ns_per_word\tfull_run_ms\tverdict\n");
+    for (int sides = REPORT_MIN_SIDES; sides <= REPORT_MAX_SIDES; sides++) {
+        report_board(sides, &rng);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <dictionary_file> [board_file]\n", argv[0]);
+        printf("       %s --report\n", argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--report") == 0) {
+        bench_report();
+        return 0;
+    }
+
+    double start = now_seconds();
+    Dictionary dictionary;
+    load_dictionary(argv[1], &dictionary, NULL);
+    printf("load: %d words in %.3f s\n", dictionary.size, now_seconds() - start);
+
+    // The same dictionary precompiled with --compile-dict
+    if (write_compiled_dictionary(&dictionary, COMPILED_BENCH_FILE) == 0) {
+        start = now_seconds();
+        Dictionary compiled;
+        load_dictionary(COMPILED_BENCH_FILE, &compiled, NULL);
+        printf("compiled load: %d words in %.6f s\n", compiled.size, now_seconds() - start);
+        bench_lookup(&compiled, "compiled");
+        free_board_and_dictionary(NULL, 0, &compiled);
+        unlink(COMPILED_BENCH_FILE);
+    }
+
+    bench_lookup(&dictionary, "text");
+
+    // Board-filtered load keeps only the words playable on the given board
+    if (argc >= 3) {
+        int num_sides;
+        char **board = parse_board(argv[2], &num_sides);
+        signed char side_of[ALPHABET_SIZE];
+        build_side_map(board, num_sides, side_of);
+
+        start = now_seconds();
+        Dictionary filtered;
+        load_dictionary(argv[1], &filtered, side_of);
+        printf("filtered load: %d of %d words in %.3f s\n", filtered.size, dictionary.size, now_seconds() - start);
+
+        bench_check(board, num_sides, &dictionary, "all words");
+        bench_check(board, num_sides, &filtered, "playable words");
+
+        free_board_and_dictionary(board, num_sides, &filtered);
+    }
+
+    free_board_and_dictionary(NULL, 0, &dictionary);
+    return 0;
+}
@@ -1,41 +1,221 @@
 // valgrind --track-origins=yes --leak-check=full ./letter-boxed
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#define MAX_LINE_LENGTH 27 // 26 alphabet + 1 for null char
-#define MAX_WORD_LENGTH 100
+#define READ_CHUNK_SIZE 65536
 #define ALPHABET_SIZE 26
+#define EMPTY_SLOT -1
+#define NO_SIDE -1
+#define COMPILED_DICT_MAGIC "LBXDICT"
+#define COMPILED_DICT_VERSION 1
+#define OUTPUT_FLUSH_SIZE 65536
 
-// Check if a word exists in the dictionary
-int word_in_dictionary(const char *word, char **dictionary, int dict_size) {
-    for (int i = 0; i < dict_size; i++) {
-        if (strcmp(word, dictionary[i]) == 0) {
-            return 1;  // Word found in the dictionary
+// Board compiled for the per-word checks
+typedef struct {
+    signed char side_of[ALPHABET_SIZE];  // letter -> side, NO_SIDE if not on the board
+    uint32_t letter_mask;                // one bit per board letter, 'a' is bit 0
+} CompiledBoard;
+
+// Outcome of checking a solution, in the priority order of the checks
+typedef enum {
+    CORRECT,
+    INVALID_BOARD,
+    LETTER_NOT_ON_BOARD,
+    FIRST_LETTER_MISMATCH,
+    SAME_SIDE_CONSECUTIVE,
+    NOT_IN_DICTIONARY,
+    NOT_ALL_LETTERS_USED
+} Verdict;
+
+const char *verdict_messages[] = {
+    [CORRECT] = "Correct",
+    [INVALID_BOARD] = "Invalid board",
+    [LETTER_NOT_ON_BOARD] = "Used a letter not present on the board",
+    [FIRST_LETTER_MISMATCH] = "First letter of word does not match last letter of previous word",
+    [SAME_SIDE_CONSECUTIVE] = "Same-side letter used consecutively",
+    [NOT_IN_DICTIONARY] = "Word not found in dictionary",
+    [NOT_ALL_LETTERS_USED] = "Not all letters used",
+};
+
+// Dictionary words plus an open-addressing hash index over them
+typedef struct {
+    char *arena;        // the words, each followed by '\0'
+    size_t arena_size;  // bytes of the arena in use
+    uint32_t *offsets;  // start of each word in the arena, in file order
+    int size;           // number of words
+    int32_t *slots;     // hash slots holding word indices, EMPTY_SLOT if unused
+    size_t slot_mask;   // number of slots - 1 (slot count is a power of two)
+    void *mapping;      // compiled dictionary file everything points into, or NULL
+    size_t mapping_size;
+} Dictionary;
+
+// Header of a compiled dictionary file (--compile-dict). It is followed by the
+// offsets array, the hash slots and the arena, so a mapped file can be used as
+// a Dictionary as is. Integers are in the byte order of the machine that
+// compiled it.
+typedef struct {
+    char magic[8];          // COMPILED_DICT_MAGIC
+    uint32_t version;       // COMPILED_DICT_VERSION
+    uint32_t num_words;
+    uint64_t num_slots;
+    uint64_t arena_size;
+    uint32_t reserved;
+    uint32_t checksum;      // FNV-1a of the header up to this field
+} CompiledDictionaryHeader;
+
+// The i-th dictionary word
+const char *dictionary_word(const Dictionary *dict, int i) {
+    return dict->arena + dict->offsets[i];
+}
+
+// FNV-1a hash of a block of bytes
+uint32_t hash_bytes(const void *bytes, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *b = bytes; length > 0; b++, length--) {
+        hash ^= *b;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a hash of a word
+uint32_t hash_word(const char *word) {
+    uint32_t hash = 2166136261u;
+    for (; *word != '\0'; word++) {
+        hash ^= (unsigned char)*word;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Build the hash index over the loaded words, keeping the load factor <= 1/2
+void build_dictionary_index(Dictionary *dict) {
+    size_t num_slots = 16;
+    while (num_slots < (size_t)dict->size * 2) {
+        num_slots <<= 1;
+    }
+
+    dict->slots = malloc(num_slots * sizeof(int32_t));
+    if (dict->slots == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    memset(dict->slots, 0xff, num_slots * sizeof(int32_t)); // all bytes 0xff == EMPTY_SLOT
+    dict->slot_mask = num_slots - 1;
+
+    for (int i = 0; i < dict->size; i++) {
+        const char *word = dictionary_word(dict, i);
+        size_t slot = hash_word(word) & dict->slot_mask;
+        // linear probing, duplicates only need to be indexed once
+        while (dict->slots[slot] != EMPTY_SLOT && strcmp(dictionary_word(dict, dict->slots[slot]), word) != 0) {
+            slot = (slot + 1) & dict->slot_mask;
+        }
+        if (dict->slots[slot] == EMPTY_SLOT) {
+            dict->slots[slot] = i;
         }
     }
-    return 0;
 }
 
-// Check if a letter exists on the board
-int letter_on_board(char letter, char **board, int num_sides) {
-    for (int i = 0; i < num_sides; i++) {
-        if (strchr(board[i], letter)) {
-            return 1;  // Letter found on the board
+// Index of the first occurrence of a word in the dictionary, -1 if absent
+int dictionary_find(const char *word, const Dictionary *dict) {
+    size_t slot = hash_word(word) & dict->slot_mask;
+    while (dict->slots[slot] != EMPTY_SLOT) {
+        if (strcmp(word, dictionary_word(dict, dict->slots[slot])) == 0) {
+            return dict->slots[slot];
         }
+        slot = (slot + 1) & dict->slot_mask;
     }
-    return 0;
+    return -1;
+}
+
+// Check if a word exists in the dictionary
+int word_in_dictionary(const char *word, const Dictionary *dict) {
+    return dictionary_find(word, dict) != -1;
 }
 
-// Which side of the board a letter is on
-int get_side_of_letter(char letter, char **board, int num_sides) {
+// Build the letter -> side lookup table, NO_SIDE for letters not on the board
+void build_side_map(char **board, int num_sides, signed char side_of[ALPHABET_SIZE]) {
+    memset(side_of, NO_SIDE, ALPHABET_SIZE);
     for (int i = 0; i < num_sides; i++) {
-        if (strchr(board[i], letter)) {
-            return i;  // Return the side index of the letter
+        for (const char *c = board[i]; *c != '\0'; c++) {
+            if (*c >= 'a' && *c <= 'z' && side_of[*c - 'a'] == NO_SIDE) {
+                side_of[*c - 'a'] = i;  // first occurrence wins
+            }
         }
     }
-    return -1;
+}
+
+// Check if a word could ever be played on the board: every letter on the board
+// and no two consecutive letters from the same side
+int word_playable(const char *word, const signed char side_of[ALPHABET_SIZE]) {
+    int prev_side = NO_SIDE;
+    for (const char *c = word; *c != '\0'; c++) {
+        if (*c < 'a' || *c > 'z') {
+            return 0;
+        }
+        int side = side_of[*c - 'a'];
+        if (side == NO_SIDE || side == prev_side) {
+            return 0;
+        }
+        prev_side = side;
+    }
+    return 1;
+}
+
+// Compile the board into the tables the per-word checks run on
+void compile_board(char **board, int num_sides, CompiledBoard *compiled) {
+    build_side_map(board, num_sides, compiled->side_of);
+    compiled->letter_mask = 0;
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        if (compiled->side_of[i] != NO_SIDE) {
+            compiled->letter_mask |= UINT32_C(1) << i;
+        }
+    }
+}
+
+// Phase 2 board checks for one word in a single pass. Reports the same error
+// the checks would in priority order: any off-board letter first, then a first
+// letter not matching prev_last_char ('\0' for the first word), then same-side
+// letters. On success adds the word's letters to *used and returns its length.
+Verdict check_word(const CompiledBoard *compiled, const char *word, char prev_last_char,
+                   uint32_t *used, size_t *length) {
+    uint32_t mask = 0;
+    int prev_side = NO_SIDE;
+    int same_side = 0;
+    const char *c = word;
+    for (; *c != '\0'; c++) {
+        unsigned index = (unsigned char)*c - 'a';
+        if (index >= ALPHABET_SIZE || compiled->side_of[index] == NO_SIDE) {
+            return LETTER_NOT_ON_BOARD;
+        }
+        int side = compiled->side_of[index];
+        same_side |= side == prev_side;
+        prev_side = side;
+        mask |= UINT32_C(1) << index;
+    }
+
+    if (prev_last_char != '\0' && word[0] != prev_last_char) {
+        return FIRST_LETTER_MISMATCH;
+    }
+    if (same_side) {
+        return SAME_SIDE_CONSECUTIVE;
+    }
+    *used |= mask;
+    *length = c - word;
+    return CORRECT;
 }
 
 // Duplicate a string
@@ -62,19 +242,19 @@ int has_repeated_letters(char **board, int num_sides) {
     return 0; 
 }
 
-// Parsing board
-char **parse_board(const char *filename, int *num_sides) {
+// Parsing board, NULL if the file can't be opened
+char **read_board(const char *filename, int *num_sides) {
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
-        printf("Error: Could not open board file.\n");
-        exit(1);
+        return NULL;
     }
 
     char **board = NULL;
-    char line[MAX_LINE_LENGTH];
+    char *line = NULL;
+    size_t line_capacity = 0;
     *num_sides = 0;
 
-    while (fgets(line, sizeof(line), file)) {
+    while (getline(&line, &line_capacity, file) != -1) {
         line[strcspn(line, "\n")] = 0;  // remove \n
         
         if (strlen(line) == 0) {
@@ -90,137 +270,1098 @@ char **parse_board(const char *filename, int *num_sides) {
         (*num_sides)++;
     }
 
+    free(line);
     fclose(file);
+    if (board == NULL) {
+        board = malloc(sizeof(char *));  // empty board, still distinct from an open failure
+        if (board == NULL) {
+            printf("Error: Memory allocation failed.\n");
+            exit(1);
+        }
+    }
     return board;
 }
 
-// Load dictionary
-char **load_dictionary(const char *filename, int *dict_size) {
-    FILE *file = fopen(filename, "r");
+// Parsing board, exiting if the file can't be opened
+char **parse_board(const char *filename, int *num_sides) {
+    char **board = read_board(filename, num_sides);
+    if (board == NULL) {
+        printf("Error: Could not open board file.\n");
+        exit(1);
+    }
+    return board;
+}
+
+// Read a whole file into one heap buffer with a trailing '\0' (a single read
+// for regular files)
+char *read_whole_file(const char *filename, size_t *length) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    size_t capacity = (fstat(fd, &st) == 0 && st.st_size > 0) ? (size_t)st.st_size + 1 : 4096;
+    char *buffer = malloc(capacity);
+    *length = 0;
+
+    while (buffer != NULL) {
+        ssize_t n;
+        if (*length + 1 == capacity) {
+            // Full: only grow if there is more to read (the file grew or is not
+            // a regular file), so a file read whole keeps its exact size
+            char extra;
+            n = read(fd, &extra, 1);
+            if (n > 0) {
+                capacity *= 2;
+                char *grown = realloc(buffer, capacity);
+                if (grown == NULL) {
+                    free(buffer);
+                    buffer = NULL;
+                    break;
+                }
+                buffer = grown;
+                buffer[(*length)++] = extra;
+                continue;
+            }
+        } else {
+            n = read(fd, buffer + *length, capacity - 1 - *length);
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                free(buffer);
+                buffer = NULL;
+            }
+            break;
+        }
+        *length += n;
+    }
+
+    close(fd);
+    if (buffer != NULL) {
+        buffer[*length] = '\0';
+    }
+    return buffer;
+}
+
+// The offsets and slots of a mapped dictionary are used without bounds checks,
+// so a damaged file is caught here by what would go wrong: an offset outside
+// the arena, an arena not ending in '\0', a slot that is neither EMPTY_SLOT nor
+// a word index, or no empty slot to stop dictionary_find. Only the integers
+// are read; the words are not hashed, so opening stays far cheaper than parsing.
+int compiled_dictionary_sound(const Dictionary *dict) {
+    if (dict->size > 0 && (dict->arena_size == 0 || dict->arena[dict->arena_size - 1] != '\0')) {
+        return 0;
+    }
+    for (int i = 0; i < dict->size; i++) {
+        if (dict->offsets[i] >= dict->arena_size) {
+            return 0;
+        }
+    }
+    int empty = 0;
+    for (size_t slot = 0; slot <= dict->slot_mask; slot++) {
+        int32_t word = dict->slots[slot];
+        if (word == EMPTY_SLOT) {
+            empty = 1;
+        } else if (word < 0 || word >= dict->size) {
+            return 0;
+        }
+    }
+    return empty;
+}
+
+// Map a dictionary written by --compile-dict. Returns 0 without touching dict
+// if the file isn't one, so the caller can treat it as text. No parsing or
+// index building happens: the Dictionary points straight into the mapping.
+int map_compiled_dictionary(const char *filename, Dictionary *dict) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;  // the text loader reports it
+    }
+
+    CompiledDictionaryHeader header;
+    struct stat st;
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, COMPILED_DICT_MAGIC, sizeof(header.magic)) != 0
+        || fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    // each size is checked against the file before they are added up, so a
+    // corrupted header cannot overflow the expected size
+    uint64_t file_size = st.st_size;
+    if (header.version != COMPILED_DICT_VERSION
+        || header.checksum != hash_bytes(&header, offsetof(CompiledDictionaryHeader, checksum))
+        || header.num_slots == 0 || (header.num_slots & (header.num_slots - 1)) != 0
+        || header.num_slots <= header.num_words || header.num_slots > file_size / sizeof(int32_t)
+        || header.arena_size > file_size
+        || file_size != sizeof(header) + header.num_words * sizeof(uint32_t)
+                        + header.num_slots * sizeof(int32_t) + header.arena_size) {
+        printf("Error: Invalid compiled dictionary file.\n");
+        exit(1);
+    }
+
+    size_t expected = file_size;
+    void *mapping = mmap(NULL, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: Could not open dictionary file.\n");
+        exit(1);
+    }
+    char *base = mapping;
+    dict->mapping = mapping;
+    dict->mapping_size = expected;
+    dict->size = header.num_words;
+    dict->offsets = (uint32_t *)(base + sizeof(header));
+    dict->slots = (int32_t *)(base + sizeof(header) + header.num_words * sizeof(uint32_t));
+    dict->slot_mask = header.num_slots - 1;
+    dict->arena = (char *)(dict->slots + header.num_slots);
+    dict->arena_size = header.arena_size;
+    if (!compiled_dictionary_sound(dict)) {
+        munmap(mapping, expected);
+        printf("Error: Invalid compiled dictionary file.\n");
+        exit(1);
+    }
+    return 1;
+}
+
+// Write a loaded dictionary in the compiled format, returns 0 on success
+int write_compiled_dictionary(const Dictionary *dict, const char *filename) {
+    FILE *file = fopen(filename, "wb");
     if (file == NULL) {
+        return -1;
+    }
+
+    CompiledDictionaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_DICT_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_DICT_VERSION;
+    header.num_words = dict->size;
+    header.num_slots = dict->slot_mask + 1;
+    header.arena_size = dict->arena_size;
+    header.checksum = hash_bytes(&header, offsetof(CompiledDictionaryHeader, checksum));
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+             && fwrite(dict->offsets, sizeof(uint32_t), dict->size, file) == (size_t)dict->size
+             && fwrite(dict->slots, sizeof(int32_t), header.num_slots, file) == header.num_slots
+             && fwrite(dict->arena, 1, dict->arena_size, file) == dict->arena_size;
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+// Load dictionary and build its lookup index. If side_of is not NULL only words
+// playable on that board are kept; any word rejected this way would fail the
+// board checks before ever reaching the dictionary lookup.
+//
+// The file is read into a single arena and split in place, so loading costs
+// one pass over the file and a handful of allocations. A compiled dictionary
+// is mapped instead, unfiltered, since its index is ready to use.
+void load_dictionary(const char *filename, Dictionary *dict, const signed char *side_of) {
+    if (map_compiled_dictionary(filename, dict)) {
+        return;
+    }
+
+    dict->mapping = NULL;
+    dict->mapping_size = 0;
+    size_t length;
+    dict->arena = read_whole_file(filename, &length);
+    if (dict->arena == NULL) {
         printf("Error: Could not open dictionary file.\n");
         exit(1);
     }
 
-    char **dictionary = NULL;
-    char word[MAX_WORD_LENGTH];
-    *dict_size = 0;
+    size_t capacity = 1024;
+    dict->offsets = malloc(capacity * sizeof(uint32_t));
+    dict->size = 0;
+    if (dict->offsets == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+
+    // Kept words are compacted towards the front of the arena as we go
+    size_t write = 0;
+    char *line = dict->arena;
+    char *end = dict->arena + length;
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        size_t word_length = (newline != NULL ? newline : end) - line;
+        line[word_length] = '\0';
 
-    while (fgets(word, sizeof(word), file)) {
-        word[strcspn(word, "\n")] = 0;
+        if (word_length > 0 && (side_of == NULL || word_playable(line, side_of))) {
+            if ((size_t)dict->size == capacity) {
+                capacity *= 2;
+                dict->offsets = realloc(dict->offsets, capacity * sizeof(uint32_t));
+                if (dict->offsets == NULL) {
+                    printf("Error: Memory allocation failed.\n");
+                    exit(1);
+                }
+            }
+            memmove(dict->arena + write, line, word_length + 1);
+            dict->offsets[dict->size] = write;
+            dict->size++;
+            write += word_length + 1;
+        }
+        line += word_length + 1;
+    }
 
-        // Dynamically allocate memory for the new word
-        dictionary = realloc(dictionary, (*dict_size + 1) * sizeof(char *));
-        if (dictionary == NULL) {
-            printf("Error: Memory allocation failed.\n");
-            exit(1);
+    // Give back what filtering freed up
+    dict->arena_size = write;
+    if (write < length) {
+        char *shrunk = realloc(dict->arena, write + 1);
+        if (shrunk != NULL) {
+            dict->arena = shrunk;
         }
-        dictionary[*dict_size] = string_duplicate(word);
-        (*dict_size)++;
     }
 
-    fclose(file);
-    return dictionary;
+    build_dictionary_index(dict);
 }
 
-// Freeing all heap allocated memory helper func
-void free_board_and_dictionary(char **board, int num_sides, char **dictionary, int dict_size) {
+// Freeing board helper func
+void free_board(char **board, int num_sides) {
     for (int i = 0; i < num_sides; i++) {
         free(board[i]);
     }
     free(board);
+}
+
+// Freeing all heap allocated memory helper func
+void free_board_and_dictionary(char **board, int num_sides, Dictionary *dict) {
+    free_board(board, num_sides);
 
-    for (int i = 0; i < dict_size; i++) {
-        free(dictionary[i]);
+    if (dict->mapping != NULL) {
+        munmap(dict->mapping, dict->mapping_size);
+        return;
     }
-    free(dictionary);
+    free(dict->arena);
+    free(dict->offsets);
+    free(dict->slots);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <board_file> <dictionary_file>\n", argv[0]);
-        return 1;
+// Seconds from a monotonic clock
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Buffered whitespace tokenizer over a file descriptor. Input is read in large
+// chunks and tokens are handed out as views into the buffer, NUL-terminated in
+// place, so there is no copy and no limit on token length.
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t capacity;    // always one byte more than we read into, for the last '\0'
+    size_t start;       // first byte not handed out yet
+    size_t end;         // end of the bytes read so far
+    int eof;
+} TokenReader;
+
+void token_reader_init(TokenReader *reader, int fd) {
+    reader->fd = fd;
+    reader->capacity = READ_CHUNK_SIZE + 1;
+    reader->buffer = malloc(reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    if (reader->buffer == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
     }
+}
 
-    // load board & dict
-    int num_sides;
-    char **board = parse_board(argv[1], &num_sides);
-    int dict_size;
-    char **dictionary = load_dictionary(argv[2], &dict_size);
-
-    // Phase 1: check if the board has fewer than 3 sides
-    if (num_sides < 3) {
-        printf("Invalid board\n");
-        free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-        return 1;
+// Whitespace as scanf("%s") sees it in the C locale
+int is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Next whitespace separated token, NULL at end of input. The token is only
+// valid until the next call.
+char *next_token(TokenReader *reader, size_t *length) {
+    size_t scan = reader->start;  // where to resume looking for the token's end
+    for (;;) {
+        while (reader->start < reader->end && is_space(reader->buffer[reader->start])) {
+            reader->start++;
+        }
+        if (scan < reader->start) {
+            scan = reader->start;
+        }
+        while (scan < reader->end && !is_space(reader->buffer[scan])) {
+            scan++;
+        }
+
+        if (scan < reader->end || (reader->eof && scan > reader->start)) {
+            char *token = reader->buffer + reader->start;
+            *length = scan - reader->start;
+            reader->buffer[scan] = '\0';  // overwrites the delimiter, or the spare byte at EOF
+            reader->start = scan < reader->end ? scan + 1 : scan;
+            return token;
+        }
+        if (reader->eof) {
+            return NULL;
+        }
+
+        // Keep the partial token, growing the buffer if it fills it, and read more
+        size_t kept = reader->end - reader->start;
+        memmove(reader->buffer, reader->buffer + reader->start, kept);
+        scan -= reader->start;
+        reader->start = 0;
+        reader->end = kept;
+        if (reader->capacity - 1 - reader->end < READ_CHUNK_SIZE / 2) {
+            reader->capacity = reader->capacity * 2 - 1;
+            reader->buffer = realloc(reader->buffer, reader->capacity);
+            if (reader->buffer == NULL) {
+                printf("Error: Memory allocation failed.\n");
+                exit(1);
+            }
+        }
+        ssize_t n = read(reader->fd, reader->buffer + reader->end, reader->capacity - 1 - reader->end);
+        if (n > 0) {
+            reader->end += n;
+        } else if (n == 0 || errno != EINTR) {
+            reader->eof = 1;
+        }
     }
+}
 
-    // Phase 1: check if the board has any repeated letters
-    if (has_repeated_letters(board, num_sides)) {
-        printf("Invalid board\n");
-        free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-        return 1;
+void token_reader_free(TokenReader *reader) {
+    free(reader->buffer);
+}
+
+// Phase 1: check the board has at least 3 sides and no repeated letters
+int board_is_valid(char **board, int num_sides) {
+    return num_sides >= 3 && !has_repeated_letters(board, num_sides);
+}
+
+// Check a solution read word by word from the input fd against the board
+Verdict check_solution(char **board, int num_sides, const Dictionary *dict, int input) {
+    if (!board_is_valid(board, num_sides)) {
+        return INVALID_BOARD;
     }
 
-    int used_letters[ALPHABET_SIZE] = {0};  // tracks used board letters
+    CompiledBoard compiled;
+    compile_board(board, num_sides, &compiled);
+    uint32_t used_letters = 0;              // tracks used board letters
     char prev_last_char = '\0';             // tracks last char from prev word
-    char word[MAX_WORD_LENGTH];
-
-    while (scanf("%s", word) != EOF) {
-        int side_used = -1;  // reset side used at new word occurrence
-
-        // Phase 2: check if each letter in the word is present on the board
-        for (size_t i = 0; i < strlen(word); i++) {
-            char letter = word[i];
-            if (!letter_on_board(letter, board, num_sides)) {
-                printf("Used a letter not present on the board\n");
-                free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-                return 0;
-            }
+    Verdict verdict = CORRECT;
+    TokenReader reader;
+    token_reader_init(&reader, input);
+    char *word;
+    size_t length;
+
+    while ((word = next_token(&reader, &length)) != NULL) {
+        // Phase 2: board rules (letters on board, first/last letters, sides)
+        verdict = check_word(&compiled, word, prev_last_char, &used_letters, &length);
+        if (verdict != CORRECT) {
+            break;
         }
 
-        // Phase 2: check if the first letter of the word matches the last letter of the previous word
-        if (prev_last_char != '\0' && word[0] != prev_last_char) {
-            printf("First letter of word does not match last letter of previous word\n");
-            free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-            return 0;
+        // Phase 2: check if the word is in the dictionary
+        if (!word_in_dictionary(word, dict)) {
+            verdict = NOT_IN_DICTIONARY;
+            break;
         }
 
-        // Phase 2: check that no same side letters are used consecutively
-        for (size_t i = 0; i < strlen(word); i++) {
-            char letter = word[i];
-            int current_side = get_side_of_letter(letter, board, num_sides);
-            if (side_used != -1 && current_side == side_used) {
-                printf("Same-side letter used consecutively\n");
-                free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-                return 0;
+        prev_last_char = word[length - 1];
+    }
+    token_reader_free(&reader);
+
+    // Phase 2: check if all letters on the board have been used
+    if (verdict == CORRECT && (used_letters & compiled.letter_mask) != compiled.letter_mask) {
+        verdict = NOT_ALL_LETTERS_USED;
+    }
+
+    return verdict;
+}
+
+// Set of 64-bit keys (open addressing), used by the solver for deduplication
+typedef struct {
+    uint64_t *keys;     // EMPTY_KEY if unused
+    size_t capacity;    // power of two
+    size_t count;
+} KeySet;
+
+#define EMPTY_KEY UINT64_MAX
+
+void key_set_init(KeySet *set) {
+    set->capacity = 1024;
+    set->count = 0;
+    set->keys = malloc(set->capacity * sizeof(uint64_t));
+    if (set->keys == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    memset(set->keys, 0xff, set->capacity * sizeof(uint64_t));  // all bytes 0xff == EMPTY_KEY
+}
+
+// Insert a key, returns 1 if it was not in the set yet
+int key_set_insert(KeySet *set, uint64_t key) {
+    if (set->count * 2 >= set->capacity) {
+        KeySet grown = {malloc(set->capacity * 2 * sizeof(uint64_t)), set->capacity * 2, 0};
+        if (grown.keys == NULL) {
+            printf("Error: Memory allocation failed.\n");
+            exit(1);
+        }
+        memset(grown.keys, 0xff, grown.capacity * sizeof(uint64_t));
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->keys[i] != EMPTY_KEY) {
+                key_set_insert(&grown, set->keys[i]);
             }
-            used_letters[letter - 'a'] = 1;
-            side_used = current_side;
         }
+        free(set->keys);
+        *set = grown;
+    }
 
-        // Phase 2: check if the word is in the dictionary
-        if (!word_in_dictionary(word, dictionary, dict_size)) {
-            printf("Word not found in dictionary\n");
-            free_board_and_dictionary(board, num_sides, dictionary, dict_size);
+    size_t slot = (size_t)((key * 0x9e3779b97f4a7c15u) >> 32) & (set->capacity - 1);
+    while (set->keys[slot] != EMPTY_KEY) {
+        if (set->keys[slot] == key) {
             return 0;
         }
-        
-        prev_last_char = word[strlen(word) - 1];
+        slot = (slot + 1) & (set->capacity - 1);
     }
+    set->keys[slot] = key;
+    set->count++;
+    return 1;
+}
 
-    // Phase 2: check if all letters on the board have been used
+// A playable word reduced to what the solver needs
+typedef struct {
+    int word;           // dictionary index
+    int first;          // board letter index of the first letter
+    int last;           // board letter index of the last letter
+    uint32_t mask;      // board letters the word covers
+} SolverWord;
+
+// BFS queue entry: a chain of words ending in `last` having covered `mask`
+typedef struct {
+    uint32_t mask;
+    int last;
+    int word;           // dictionary index of the word that led here
+    int parent;         // queue index of the previous state, -1 for the first word
+} SolverState;
+
+// The solver's BFS queue, states are never removed so parents stay addressable
+typedef struct {
+    SolverState *states;
+    int size;
+    int capacity;
+} SolverQueue;
+
+// Append a state to the BFS queue
+void push_state(SolverQueue *queue, SolverState state) {
+    if (queue->size == queue->capacity) {
+        queue->capacity = queue->capacity == 0 ? 1024 : queue->capacity * 2;
+        queue->states = realloc(queue->states, queue->capacity * sizeof(SolverState));
+        if (queue->states == NULL) {
+            printf("Error: Memory allocation failed.\n");
+            exit(1);
+        }
+    }
+    queue->states[queue->size++] = state;
+}
+
+// If the newest queued state can be finished with one more word, queue that
+// word and return its queue index, otherwise -1
+int finish_state(SolverQueue *queue, const SolverWord *by_first, const int *bucket_start, uint32_t full_mask) {
+    int parent = queue->size - 1;
+    SolverState state = queue->states[parent];
+    uint32_t missing = full_mask & ~state.mask;
+    for (int i = bucket_start[state.last]; i < bucket_start[state.last + 1]; i++) {
+        if ((missing & ~by_first[i].mask) == 0) {
+            push_state(queue, (SolverState){full_mask, by_first[i].last, by_first[i].word, parent});
+            return queue->size - 1;
+        }
+    }
+    return -1;
+}
+
+// Number of set bits
+int count_bits(uint32_t mask) {
+    int bits = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        bits++;
+    }
+    return bits;
+}
+
+// qsort order for solver words: first letter, last letter, most letters
+// covered, then dictionary order
+int compare_solver_words(const void *a, const void *b) {
+    const SolverWord *x = a;
+    const SolverWord *y = b;
+    if (x->first != y->first) {
+        return x->first - y->first;
+    }
+    if (x->last != y->last) {
+        return x->last - y->last;
+    }
+    if (count_bits(x->mask) != count_bits(y->mask)) {
+        return count_bits(y->mask) - count_bits(x->mask);
+    }
+    return x->word - y->word;
+}
+
+// Number the board letters 0..n-1 so covered letters fit in a bitmask,
+// returns n. Letters not on the board get NO_SIDE.
+int number_board_letters(char **board, int num_sides, int letter_bit[ALPHABET_SIZE]) {
+    int num_letters = 0;
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        letter_bit[i] = NO_SIDE;
+    }
     for (int i = 0; i < num_sides; i++) {
-        for (size_t j = 0; j < strlen(board[i]); j++) {
-            if (!used_letters[board[i][j] - 'a']) {
-                printf("Not all letters used\n");
-                free_board_and_dictionary(board, num_sides, dictionary, dict_size);
-                return 0;
+        for (const char *c = board[i]; *c != '\0'; c++) {
+            if (*c >= 'a' && *c <= 'z' && letter_bit[*c - 'a'] == NO_SIDE) {
+                letter_bit[*c - 'a'] = num_letters++;
+            }
+        }
+    }
+    return num_letters;
+}
+
+// Reduce the distinct playable dictionary words to (first, last, mask), in
+// dictionary order (caller frees)
+SolverWord *collect_solver_words(const Dictionary *dict, const signed char side_of[ALPHABET_SIZE],
+                                 const int letter_bit[ALPHABET_SIZE], int *count) {
+    SolverWord *words = malloc((dict->size + 1) * sizeof(SolverWord));
+    if (words == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    *count = 0;
+    for (int i = 0; i < dict->size; i++) {
+        const char *word = dictionary_word(dict, i);
+        if (!word_playable(word, side_of) || dictionary_find(word, dict) != i) {
+            continue;  // unplayable, or a repeat of an earlier entry
+        }
+        SolverWord w = {i, letter_bit[word[0] - 'a'], 0, 0};
+        for (const char *c = word; *c != '\0'; c++) {
+            w.last = letter_bit[*c - 'a'];
+            w.mask |= UINT32_C(1) << w.last;
+        }
+        words[(*count)++] = w;
+    }
+    return words;
+}
+
+// Find a solution using as few words as possible. BFS over (last letter,
+// covered letters) states, so the first state covering the whole board is a
+// shortest chain. Returns the dictionary indices of the words (caller frees)
+// or NULL if the board cannot be solved.
+int *solve_board(char **board, int num_sides, const signed char side_of[ALPHABET_SIZE],
+                 const Dictionary *dict, int *num_words) {
+    int letter_bit[ALPHABET_SIZE];
+    int num_letters = number_board_letters(board, num_sides, letter_bit);
+    uint32_t full_mask = (UINT32_C(1) << num_letters) - 1;
+    int num_playable;
+    SolverWord *words = collect_solver_words(dict, side_of, letter_bit, &num_playable);
+    int *bucket_start = calloc(num_letters + 1, sizeof(int));
+    if (bucket_start == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+
+    // Between words with the same first and last letter, one whose letters are a
+    // subset of another's can always be swapped for it, so only keep the maximal
+    // ones. Sorting by (first, last, most letters) puts them at the front of each
+    // group and leaves the words indexed by first letter.
+    qsort(words, num_playable, sizeof(SolverWord), compare_solver_words);
+    SolverWord *by_first = words;
+    int count = 0;
+    int group = 0;
+    for (int i = 0; i < num_playable; i++) {
+        if (i > 0 && (words[i].first != words[i - 1].first || words[i].last != words[i - 1].last)) {
+            group = count;
+        }
+        int dominated = 0;
+        for (int j = group; j < count && !dominated; j++) {
+            dominated = (words[i].mask & ~by_first[j].mask) == 0;
+        }
+        if (!dominated) {
+            by_first[count++] = words[i];
+            bucket_start[words[i].first + 1]++;
+        }
+    }
+    for (int i = 0; i < num_letters; i++) {
+        bucket_start[i + 1] += bucket_start[i];
+    }
+
+    SolverQueue queue = {NULL, 0, 0};
+    KeySet visited;
+    key_set_init(&visited);
+    int goal = -1;  // queue index of the final state of the solution
+
+    // A single word covering the whole board
+    for (int i = 0; i < count && goal == -1; i++) {
+        if (by_first[i].mask == full_mask) {
+            push_state(&queue, (SolverState){full_mask, by_first[i].last, by_first[i].word, -1});
+            goal = queue.size - 1;
+        }
+    }
+
+    // Otherwise BFS with every word on its own as a starting state. Each new
+    // state is checked for a finishing word right away, so the search stops
+    // without building the layer the solution ends in.
+    for (int i = 0; i < count && goal == -1; i++) {
+        uint64_t key = ((uint64_t)by_first[i].last << 32) | by_first[i].mask;
+        if (key_set_insert(&visited, key)) {
+            push_state(&queue, (SolverState){by_first[i].mask, by_first[i].last, by_first[i].word, -1});
+            goal = finish_state(&queue, by_first, bucket_start, full_mask);
+        }
+    }
+
+    for (int head = 0; head < queue.size && goal == -1; head++) {
+        SolverState state = queue.states[head];
+        for (int i = bucket_start[state.last]; i < bucket_start[state.last + 1] && goal == -1; i++) {
+            uint32_t mask = state.mask | by_first[i].mask;
+            if (mask == state.mask) {
+                continue;  // covers nothing new, never part of a shortest chain
+            }
+            uint64_t key = ((uint64_t)by_first[i].last << 32) | mask;
+            if (key_set_insert(&visited, key)) {
+                push_state(&queue, (SolverState){mask, by_first[i].last, by_first[i].word, head});
+                goal = finish_state(&queue, by_first, bucket_start, full_mask);
+            }
+        }
+    }
+    free(visited.keys);
+    free(words);
+    free(bucket_start);
+
+    int *solution = NULL;
+    *num_words = 0;
+    if (goal != -1) {
+        for (int i = goal; i != -1; i = queue.states[i].parent) {
+            (*num_words)++;
+        }
+        solution = malloc(*num_words * sizeof(int));
+        if (solution == NULL) {
+            printf("Error: Memory allocation failed.\n");
+            exit(1);
+        }
+        int pos = *num_words;
+        for (int i = goal; i != -1; i = queue.states[i].parent) {
+            solution[--pos] = queue.states[i].word;
+        }
+    }
+    free(queue.states);
+    return solution;
+}
+
+// State shared by the enumeration worker threads
+typedef struct {
+    const Dictionary *dict;
+    const SolverWord *words;    // distinct playable words sorted by first letter
+    const int *bucket_start;    // words starting with board letter i are [bucket_start[i], bucket_start[i + 1])
+    int num_words;
+    uint32_t full_mask;
+    int max_words;
+    int next_start;             // next starting word to hand out
+    long solutions;             // totals, added up as workers finish
+    long nodes;
+    pthread_mutex_t lock;       // guards next_start, the totals and stdout
+} Enumeration;
+
+// One enumeration worker: the chain being extended and its own output buffer
+typedef struct {
+    Enumeration *enumeration;
+    int *path;                  // dictionary indices of the chain so far
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+    long solutions;
+    long nodes;
+} EnumerationWorker;
+
+// Write out a worker's buffered solutions
+void flush_enumeration_output(EnumerationWorker *worker) {
+    pthread_mutex_lock(&worker->enumeration->lock);
+    fwrite(worker->output, 1, worker->output_size, stdout);
+    pthread_mutex_unlock(&worker->enumeration->lock);
+    worker->output_size = 0;
+}
+
+// Buffer the current chain as one output line, words separated by spaces
+void emit_solution(EnumerationWorker *worker, int num_words) {
+    for (int i = 0; i < num_words; i++) {
+        const char *word = dictionary_word(worker->enumeration->dict, worker->path[i]);
+        size_t length = strlen(word);
+        if (worker->output_size + length + 1 > worker->output_capacity) {
+            worker->output_capacity = (worker->output_size + length + 1) * 2;
+            worker->output = realloc(worker->output, worker->output_capacity);
+            if (worker->output == NULL) {
+                printf("Error: Memory allocation failed.\n");
+                exit(1);
+            }
+        }
+        memcpy(worker->output + worker->output_size, word, length);
+        worker->output_size += length;
+        worker->output[worker->output_size++] = i + 1 < num_words ? ' ' : '\n';
+    }
+    worker->solutions++;
+    if (worker->output_size >= OUTPUT_FLUSH_SIZE) {
+        flush_enumeration_output(worker);
+    }
+}
+
+// Depth-first extension of a chain of `depth` words ending in `last`. A chain
+// is reported as soon as it covers the board and never extended past that.
+// Like the solver, words that cover no new letter are skipped: they would only
+// pad a shorter solution.
+void enumerate_chains(EnumerationWorker *worker, int depth, int last, uint32_t mask) {
+    const Enumeration *e = worker->enumeration;
+    for (int i = e->bucket_start[last]; i < e->bucket_start[last + 1]; i++) {
+        uint32_t covered = mask | e->words[i].mask;
+        if (covered == mask) {
+            continue;
+        }
+        worker->nodes++;
+        worker->path[depth] = e->words[i].word;
+        if (covered == e->full_mask) {
+            emit_solution(worker, depth + 1);
+        } else if (depth + 1 < e->max_words) {
+            enumerate_chains(worker, depth + 1, e->words[i].last, covered);
+        }
+    }
+}
+
+// Worker thread: take starting words one at a time until none are left
+void *enumeration_worker(void *arg) {
+    Enumeration *e = arg;
+    EnumerationWorker worker = {e, malloc(e->max_words * sizeof(int)), NULL, 0, 0, 0, 0};
+    if (worker.path == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&e->lock);
+        int i = e->next_start++;
+        pthread_mutex_unlock(&e->lock);
+        if (i >= e->num_words) {
+            break;
+        }
+
+        worker.nodes++;
+        worker.path[0] = e->words[i].word;
+        if (e->words[i].mask == e->full_mask) {
+            emit_solution(&worker, 1);
+        } else if (e->max_words > 1) {
+            enumerate_chains(&worker, 1, e->words[i].last, e->words[i].mask);
+        }
+    }
+
+    flush_enumeration_output(&worker);
+    pthread_mutex_lock(&e->lock);
+    e->solutions += worker.solutions;
+    e->nodes += worker.nodes;
+    pthread_mutex_unlock(&e->lock);
+    free(worker.path);
+    free(worker.output);
+    return NULL;
+}
+
+// Print every solution of at most max_words words, one per line, searching in
+// parallel with each thread taking the next starting word (in first letter
+// order) when it runs out of work. Lines come out in no particular order.
+void enumerate_solutions(char **board, int num_sides, const signed char side_of[ALPHABET_SIZE],
+                         const Dictionary *dict, int max_words, int num_threads) {
+    double start = now_seconds();
+    int letter_bit[ALPHABET_SIZE];
+    int num_letters = number_board_letters(board, num_sides, letter_bit);
+
+    Enumeration e;
+    SolverWord *words = collect_solver_words(dict, side_of, letter_bit, &e.num_words);
+    qsort(words, e.num_words, sizeof(SolverWord), compare_solver_words);
+    int *bucket_start = calloc(num_letters + 1, sizeof(int));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (bucket_start == NULL || threads == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    for (int i = 0; i < e.num_words; i++) {
+        bucket_start[words[i].first + 1]++;
+    }
+    for (int i = 0; i < num_letters; i++) {
+        bucket_start[i + 1] += bucket_start[i];
+    }
+
+    e.dict = dict;
+    e.words = words;
+    e.bucket_start = bucket_start;
+    e.full_mask = (UINT32_C(1) << num_letters) - 1;
+    e.max_words = max_words;
+    e.next_start = 0;
+    e.solutions = 0;
+    e.nodes = 0;
+    pthread_mutex_init(&e.lock, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, enumeration_worker, &e);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "Found %ld solutions of up to %d words, explored %ld nodes in %.3f s (%.0f nodes/sec) using %d threads\n",
+            e.solutions, max_words, e.nodes, elapsed, e.nodes / (elapsed > 0 ? elapsed : 1e-9), num_threads);
+
+    pthread_mutex_destroy(&e.lock);
+    free(threads);
+    free(bucket_start);
+    free(words);
+}
+
+// One (board file, solution file) pair from a batch manifest
+typedef struct {
+    char *board_file;
+    char *solution_file;
+    const char *result;     // verdict message or error
+    double seconds;         // time spent checking this item
+    int done;
+} BatchItem;
+
+// State shared by the batch worker threads
+typedef struct {
+    BatchItem *items;
+    int num_items;
+    int next_item;          // next item to hand out
+    const Dictionary *dict; // shared read-only
+    pthread_mutex_t lock;
+    pthread_cond_t item_done;
+} Batch;
+
+// Check one batch item against the shared dictionary
+void check_batch_item(BatchItem *item, const Dictionary *dict) {
+    double start = now_seconds();
+
+    int num_sides;
+    char **board = read_board(item->board_file, &num_sides);
+    int input = open(item->solution_file, O_RDONLY);
+    if (board == NULL) {
+        item->result = "Error: Could not open board file.";
+    } else if (input < 0) {
+        item->result = "Error: Could not open solution file.";
+    } else {
+        item->result = verdict_messages[check_solution(board, num_sides, dict, input)];
+    }
+
+    if (input >= 0) {
+        close(input);
+    }
+    if (board != NULL) {
+        free_board(board, num_sides);
+    }
+    item->seconds = now_seconds() - start;
+}
+
+// Worker thread: take items off the manifest until none are left
+void *batch_worker(void *arg) {
+    Batch *batch = arg;
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->next_item++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->num_items) {
+            return NULL;
+        }
+
+        check_batch_item(&batch->items[i], batch->dict);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->items[i].done = 1;
+        pthread_cond_broadcast(&batch->item_done);
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+// Read the manifest: one "<board_file> <solution_file>" pair per line
+BatchItem *read_manifest(const char *filename, int *num_items) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Error: Could not open manifest file.\n");
+        exit(1);
+    }
+
+    BatchItem *items = NULL;
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    *num_items = 0;
+
+    while (getline(&line, &line_capacity, file) != -1) {
+        char *save;
+        char *board_file = strtok_r(line, " \t\r\n", &save);
+        char *solution_file = strtok_r(NULL, " \t\r\n", &save);
+        if (board_file == NULL) {
+            continue;  // blank line
+        }
+        if (solution_file == NULL) {
+            printf("Error: Manifest line missing solution file.\n");
+            exit(1);
+        }
+
+        if (*num_items == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            items = realloc(items, capacity * sizeof(BatchItem));
+            if (items == NULL) {
+                printf("Error: Memory allocation failed.\n");
+                exit(1);
             }
         }
+        items[*num_items] = (BatchItem){string_duplicate(board_file), string_duplicate(solution_file), NULL, 0, 0};
+        (*num_items)++;
     }
 
-    printf("Correct\n");
-    free_board_and_dictionary(board, num_sides, dictionary, dict_size);
+    free(line);
+    fclose(file);
+    return items;
+}
+
+// Batch mode: check every pair in the manifest against one shared dictionary
+// using a pool of worker threads, printing results in manifest order
+int run_batch(const char *manifest_file, const char *dictionary_file, int num_threads) {
+    double start = now_seconds();
+    Batch batch;
+    batch.items = read_manifest(manifest_file, &batch.num_items);
+    batch.next_item = 0;
+    Dictionary dictionary;
+    load_dictionary(dictionary_file, &dictionary, NULL);  // boards differ, so no filtering
+    batch.dict = &dictionary;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.item_done, NULL);
+
+    if (num_threads > batch.num_items) {
+        num_threads = batch.num_items;
+    }
+    pthread_t *threads = malloc((num_threads + 1) * sizeof(pthread_t));
+    if (threads == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, batch_worker, &batch);
+    }
+
+    // Print each result as soon as it and everything before it is done
+    pthread_mutex_lock(&batch.lock);
+    for (int i = 0; i < batch.num_items; i++) {
+        while (!batch.items[i].done) {
+            pthread_cond_wait(&batch.item_done, &batch.lock);
+        }
+        printf("%s %s: %s (%.3f ms)\n", batch.items[i].board_file, batch.items[i].solution_file,
+               batch.items[i].result, batch.items[i].seconds * 1e3);
+    }
+    pthread_mutex_unlock(&batch.lock);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    fprintf(stderr, "Checked %d solutions in %.3f ms using %d threads\n", batch.num_items,
+            (now_seconds() - start) * 1e3, num_threads);
+
+    for (int i = 0; i < batch.num_items; i++) {
+        free(batch.items[i].board_file);
+        free(batch.items[i].solution_file);
+    }
+    free(batch.items);
+    free(threads);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.item_done);
+    free_board_and_dictionary(NULL, 0, &dictionary);
     return 0;
-}
\ No newline at end of file
+}
+
+#ifndef LETTER_BOXED_NO_MAIN
+int main(int argc, char *argv[]) {
+    // Compile mode: --compile-dict <dictionary_file> <output_file>
+    if (argc > 1 && strcmp(argv[1], "--compile-dict") == 0) {
+        if (argc < 4) {
+            printf("Usage: %s --compile-dict <dictionary_file> <output_file>\n", argv[0]);
+            return 1;
+        }
+        Dictionary dictionary;
+        load_dictionary(argv[2], &dictionary, NULL);
+        int failed = write_compiled_dictionary(&dictionary, argv[3]);
+        if (failed) {
+            printf("Error: Could not write compiled dictionary.\n");
+        }
+        free_board_and_dictionary(NULL, 0, &dictionary);
+        return failed ? 1 : 0;
+    }
+
+    // Batch mode: --batch <manifest_file> <dictionary_file> [threads]
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        if (argc < 4) {
+            printf("Usage: %s --batch <manifest_file> <dictionary_file> [threads]\n", argv[0]);
+            return 1;
+        }
+        int num_threads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        return run_batch(argv[2], argv[3], num_threads > 0 ? num_threads : 1);
+    }
+
+    // Enumerate mode: --enumerate <max_words> <board_file> <dictionary_file> [threads]
+    int enumerate = argc > 1 && strcmp(argv[1], "--enumerate") == 0;
+    int max_words = 0;
+    int num_threads = 1;
+    if (enumerate) {
+        if (argc < 5 || (max_words = atoi(argv[2])) < 1) {
+            printf("Usage: %s --enumerate <max_words> <board_file> <dictionary_file> [threads]\n", argv[0]);
+            return 1;
+        }
+        num_threads = argc > 5 ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_threads < 1) {
+            num_threads = 1;
+        }
+    }
+
+    int solve = argc > 1 && strcmp(argv[1], "--solve") == 0;
+    int arg = enumerate ? 3 : solve ? 2 : 1;
+    if (argc < arg + 2) {
+        printf("Usage: %s [--solve] <board_file> <dictionary_file>\n", argv[0]);
+        return 1;
+    }
+
+    // load board & dict
+    int num_sides;
+    char **board = parse_board(argv[arg], &num_sides);
+    signed char side_of[ALPHABET_SIZE];
+    build_side_map(board, num_sides, side_of);
+    Dictionary dictionary;
+    load_dictionary(argv[arg + 1], &dictionary, side_of);
+
+    if ((solve || enumerate) && !board_is_valid(board, num_sides)) {
+        printf("%s\n", verdict_messages[INVALID_BOARD]);
+        free_board_and_dictionary(board, num_sides, &dictionary);
+        return 1;
+    }
+
+    if (enumerate) {
+        enumerate_solutions(board, num_sides, side_of, &dictionary, max_words, num_threads);
+        free_board_and_dictionary(board, num_sides, &dictionary);
+        return 0;
+    }
+
+    // Solver mode: print a shortest solution, one word per line
+    if (solve) {
+        int num_words;
+        int *solution = solve_board(board, num_sides, side_of, &dictionary, &num_words);
+        if (solution == NULL) {
+            printf("No solution found\n");
+        }
+        for (int i = 0; i < num_words; i++) {
+            printf("%s\n", dictionary_word(&dictionary, solution[i]));
+        }
+        free(solution);
+        free_board_and_dictionary(board, num_sides, &dictionary);
+        return 0;
+    }
+
+    Verdict verdict = check_solution(board, num_sides, &dictionary, STDIN_FILENO);
+    printf("%s\n", verdict_messages[verdict]);
+    free_board_and_dictionary(board, num_sides, &dictionary);
+    return verdict == INVALID_BOARD ? 1 : 0;
+}
+#endif
@@ -0,0 +1,185 @@
+// Benchmarks for wsh, run with `make bench` and `make bench-substitute`
+// Usage: ./wsh-bench <shell> [shell...]
+//        ./wsh-bench --substitute
+//
+// With shells, writes batch files made of many short commands, runs each given
+// shell on them with its output discarded and prints one tab-separated row per
+// shell and workload with the number of commands run per second.
+//
+// --substitute times substitute_variables() in process on long lines full of
+// variables, against the fixed-size strcat version it replaced.
+
+#define _GNU_SOURCE
+#define WSH_NO_MAIN
+#include "wsh.c"
+
+#define BENCH_COMMANDS 5000
+#define BENCH_REPEATS 3
+#define SUBSTITUTE_ROUNDS 2000
+#define SUBSTITUTE_VARIABLES 100
+
+typedef struct {
+    const char *name;
+    const char *line; // one command of the batch file
+} Workload;
+
+// full paths always start the programs, plain names may run as utility builtins in the shell
+static const Workload workloads[] = {
+    {"utility", "true\n"},
+    {"true", "/bin/true\n"},
+    {"redirect", "/bin/echo bench >/dev/null\n"},
+    {"pipeline", "/bin/echo bench | /bin/cat\n"},
+};
+
+// writes a batch file repeating line, returns its malloced path
+char *write_batch_file(const char *line, int commands) {
+    char *path = strdup("/tmp/wsh-bench-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    FILE *batch = fdopen(fd, "w");
+    for (int i = 0; i < commands; i++) {
+        fputs(line, batch);
+    }
+    fclose(batch);
+    return path;
+}
+
+// runs the shell on the batch file with all output discarded, returns the wall time
+double run_shell(const char *shell, const char *batch_path) {
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+        execl(shell, shell, batch_path, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = now_seconds() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "Error: could not run %s\n", shell);
+        exit(1);
+    }
+    return elapsed;
+}
+
+// The substitution as it was before the growable buffer, kept as a baseline:
+// one strncat per character into a fixed buffer, so lines must stay below MAXLINE
+void legacy_substitute_variables(char *command, ShellVariables *sv) {
+    char temp[MAXLINE] = "";
+    char *pos = command;
+    while (*pos) {
+        if (*pos == '$') {
+            pos++;
+            char var_name[MAXLINE] = "";
+            int i = 0;
+            while (*pos && *pos != ' ' && *pos != '$') {
+                var_name[i++] = *pos++;
+            }
+            var_name[i] = '\0';
+
+            char *value = getenv(var_name);
+            if (!value) {
+                value = get_shell_variable(sv, var_name);
+            }
+            if (value) {
+                strcat(temp, value);
+            }
+        } else {
+            strncat(temp, pos, 1);
+            pos++;
+        }
+    }
+    strcpy(command, temp);
+}
+
+// a line of about length bytes alternating words and $vN references
+char *make_substitute_line(size_t length) {
+    StringBuffer line;
+    init_string_buffer(&line, length + 64);
+    char word[32];
+    for (int i = 0; line.length < length; i++) {
+        int n = snprintf(word, sizeof(word), i % 2 ? "$v%d " : "arg%d ", i % SUBSTITUTE_VARIABLES);
+        append_string(&line, word, n);
+    }
+    return line.data;
+}
+
+void bench_substitute(void) {
+    ShellVariables sv = {.head = NULL};
+    char name[32];
+    for (int i = 0; i < SUBSTITUTE_VARIABLES; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        set_shell_variable(&sv, name, "value");
+    }
+
+    printf("implementation\tline_bytes\trounds\tseconds\tmb_per_second\n");
+    size_t lengths[] = {200, 400, 10000, 1000000};
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        char *line = make_substitute_line(lengths[l]);
+        size_t bytes = strlen(line);
+        int rounds = bytes > 100000 ? 20 : SUBSTITUTE_ROUNDS;
+
+        // the result is the same length as the line, so the baseline only fits the short lines
+        if (bytes < MAXLINE / 2) {
+            char buffer[MAXLINE];
+            double start = now_seconds();
+            for (int r = 0; r < rounds; r++) {
+                strcpy(buffer, line);
+                legacy_substitute_variables(buffer, &sv);
+            }
+            double elapsed = now_seconds() - start;
+            printf("strcat\t%zu\t%d\t%.4f\t%.1f\n", bytes, rounds, elapsed, bytes * rounds / elapsed / 1e6);
+        }
+
+        double start = now_seconds();
+        for (int r = 0; r < rounds; r++) {
+            free(substitute_variables(line, &sv, NULL));
+        }
+        double elapsed = now_seconds() - start;
+        printf("buffer\t%zu\t%d\t%.4f\t%.1f\n", bytes, rounds, elapsed, bytes * rounds / elapsed / 1e6);
+        free(line);
+    }
+    free_shell_variables(&sv);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "--substitute") == 0) {
+        bench_substitute();
+        return 0;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <shell> [shell...]\n       %s --substitute\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    printf("shell\tworkload\tcommands\tseconds\tcommands_per_second\n");
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        char *batch_path = write_batch_file(workloads[w].line, BENCH_COMMANDS);
+        for (int s = 1; s < argc; s++) {
+            double best = 0;
+            for (int r = 0; r < BENCH_REPEATS; r++) { // best of a few runs, the first one warms the page cache
+                double elapsed = run_shell(argv[s], batch_path);
+                if (r == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+            printf("%s\t%s\t%d\t%.3f\t%.0f\n", argv[s], workloads[w].name, BENCH_COMMANDS, best,
+                   BENCH_COMMANDS / best);
+            fflush(stdout);
+        }
+        unlink(batch_path);
+        free(batch_path);
+    }
+    return 0;
+}
@@ -1,60 +1,225 @@
+#define _GNU_SOURCE
 #include "wsh.h"
+#include <errno.h>
+#include <spawn.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <time.h>
 
 // the following history functions allow modification of the history of commands we track
+// the commands are a ring buffer with the oldest command at start, so adding one never moves the others
 void init_history(History *history, int capacity) {
     history->commands = malloc(capacity * sizeof(char *));
+    history->start = 0;
     history->size = 0;
     history->capacity = capacity;
+    history->file_fd = -1;
+    history->file_path = NULL;
 }
 
 void free_history(History *history) {
     for (int i = 0; i < history->size; i++) {
-        free(history->commands[i]);
+        free(history->commands[(history->start + i) % history->capacity]);
     }
     free(history->commands);
+    if (history->file_fd != -1) {
+        close(history->file_fd);
+    }
+    free(history->file_path);
 }
 
-void add_to_history(History *history, const char *command) {
-    if (history->size > 0 && strcmp(history->commands[history->size - 1], command) == 0) {
+// n-th most recent command, 1 is the most recent
+char *history_entry(const History *history, int n) {
+    return history->commands[(history->start + history->size - n) % history->capacity];
+}
+
+// adds to the ring only, the oldest command is dropped once it is full
+void push_history(History *history, const char *command) {
+    if (history->size > 0 && strcmp(history_entry(history, 1), command) == 0) {
         return;
     }
 
     if (history->size == history->capacity) {
-        free(history->commands[0]);
-        for (int i = 1; i < history->size; i++) {
-            history->commands[i - 1] = history->commands[i];
+        free(history->commands[history->start]);
+        history->commands[history->start] = strdup(command);
+        history->start = (history->start + 1) % history->capacity;
+    } else {
+        history->commands[(history->start + history->size) % history->capacity] = strdup(command);
+        history->size++;
+    }
+}
+
+void add_to_history(History *history, const char *command) {
+    if (history->size > 0 && strcmp(history_entry(history, 1), command) == 0) {
+        return; // not written to the file either
+    }
+    push_history(history, command);
+
+    if (history->file_fd != -1) { // one append per command, the file is only read back when needed
+        size_t length = strlen(command);
+        char *line = malloc(length + 1);
+        memcpy(line, command, length);
+        line[length] = '\n';
+        if (write(history->file_fd, line, length + 1) != (ssize_t)(length + 1)) {
+            perror("history");
+        }
+        free(line);
+    }
+}
+
+// keeps the most recent commands that fit into the new capacity
+void resize_history(History *history, int capacity) {
+    char **commands = malloc(capacity * sizeof(char *));
+    int keep = history->size < capacity ? history->size : capacity;
+    for (int i = 0; i < history->size - keep; i++) {
+        free(history->commands[(history->start + i) % history->capacity]);
+    }
+    for (int i = 0; i < keep; i++) {
+        commands[i] = history_entry(history, keep - i);
+    }
+
+    free(history->commands);
+    history->commands = commands;
+    history->start = 0;
+    history->size = keep;
+    history->capacity = capacity;
+}
+
+// last line of the file, found by reading backwards from its end, NULL if there is none
+char *read_last_line(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        return NULL;
+    }
+    off_t end = st.st_size;
+    char last;
+    if (pread(fd, &last, 1, end - 1) == 1 && last == '\n') {
+        end--;
+    }
+
+    off_t start = end;
+    char chunk[4096];
+    while (start > 0) {
+        off_t from = start > (off_t)sizeof(chunk) ? start - (off_t)sizeof(chunk) : 0;
+        if (pread(fd, chunk, start - from, from) != start - from) {
+            return NULL;
+        }
+        char *newline = memrchr(chunk, '\n', start - from);
+        if (newline != NULL) {
+            start = from + (newline - chunk) + 1;
+            break;
+        }
+        start = from;
+    }
+
+    char *line = malloc(end - start + 1);
+    if (pread(fd, line, end - start, start) != end - start) {
+        free(line);
+        return NULL;
+    }
+    line[end - start] = '\0';
+    return line;
+}
+
+// commands are appended to path, and the file is only read the first time the history is used
+// its last command is read right away, so a command repeated from the previous session is not appended twice
+void open_history_file(History *history, const char *path) {
+    history->file_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history->file_fd == -1) {
+        perror("history");
+        return;
+    }
+    history->file_path = strdup(path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        char *last = read_last_line(fd);
+        if (last != NULL && last[0] != '\0') {
+            push_history(history, last);
         }
-        history->size--;
+        free(last);
+        close(fd);
+    }
+}
+
+// every command added so far was also appended to the file, so the file alone rebuilds the history
+void load_history(History *history) {
+    if (history->file_path == NULL) {
+        return;
     }
+    int fd = open(history->file_path, O_RDONLY | O_CLOEXEC);
+    free(history->file_path);
+    history->file_path = NULL; // loaded
+    if (fd == -1) {
+        perror("history");
+        return;
+    }
+
+    StringBuffer contents;
+    init_string_buffer(&contents, 4096);
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        append_string(&contents, chunk, n);
+    }
+    close(fd);
 
-    history->commands[history->size] = strdup(command);
-    history->size++;
+    for (int i = 0; i < history->size; i++) {
+        free(history->commands[(history->start + i) % history->capacity]);
+    }
+    history->start = 0;
+    history->size = 0;
+    // the ring ends up with the most recent lines of the file
+    for (char *line = strtok(contents.data, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        push_history(history, line);
+    }
+    free(contents.data);
 }
 
 void print_history(const History *history) {
-    for (int i = history->size - 1; i >= 0; i--) {
-        printf("%d) %s\n", history->size - i, history->commands[i]);
+    for (int n = 1; n <= history->size; n++) {
+        printf("%d) %s\n", n, history_entry(history, n));
     }
 }
 
 // the following functions allow modification and management of shell variables
+const char *variable_key(const void *slots, int i) {
+    const ShellVariable *var = ((ShellVariable *const *)slots)[i];
+    return var == NULL ? NULL : var->name;
+}
+
+ShellVariable **find_variable_slot(ShellVariables *sv, const char *name) {
+    return &sv->slots[find_slot(sv->slots, sv->capacity, name, variable_key)];
+}
+
+void grow_shell_variables(ShellVariables *sv) {
+    int capacity = sv->capacity == 0 ? DEFAULTVARIABLES : sv->capacity * 2;
+    sv->slots = grow_slots(sv->slots, sv->capacity, capacity, sizeof(ShellVariable *), variable_key);
+    sv->capacity = capacity;
+}
+
 void set_shell_variable(ShellVariables *sv, const char *name, const char *value) {
-    ShellVariable *current = sv->head;
+    if ((sv->size + 1) * 2 > sv->capacity) { // keeping the load factor <= 1/2
+        grow_shell_variables(sv);
+    }
 
-    while (current) { // while the var exists
-        if (strcmp(current->name, name) == 0) {
-            free(current->value);
-            current->value = strdup(value);
-            return;
-        }
-        current = current->next;
+    ShellVariable **slot = find_variable_slot(sv, name);
+    if (*slot) { // the var exists, it keeps its place in the list
+        free((*slot)->value);
+        (*slot)->value = strdup(value);
+        return;
     }
 
     ShellVariable *new_var = malloc(sizeof(ShellVariable));
@@ -64,23 +229,19 @@ void set_shell_variable(ShellVariables *sv, const char *name, const char *value)
     if (sv->head == NULL) {
         sv->head = new_var;
     } else {
-        current = sv->head;
-        while (current->next) {
-            current = current->next;
-        }
-        current->next = new_var;
+        sv->tail->next = new_var;
     }
+    sv->tail = new_var;
+    *slot = new_var;
+    sv->size++;
 }
 
 char *get_shell_variable(ShellVariables *sv, const char *name) {
-    ShellVariable *current = sv->head;
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-            return current->value;
-        }
-        current = current->next;
+    if (sv->capacity == 0) {
+        return NULL;
     }
-    return NULL;
+    ShellVariable *var = *find_variable_slot(sv, name);
+    return var ? var->value : NULL;
 }
 
 void free_shell_variables(ShellVariables *sv) {
@@ -92,469 +253,2378 @@ void free_shell_variables(ShellVariables *sv) {
         free(to_free->value);
         free(to_free);
     }
+    free(sv->slots);
+}
+
+// the following functions build strings of any length with a write cursor
+void init_string_buffer(StringBuffer *buffer, size_t capacity) {
+    buffer->data = malloc(capacity);
+    buffer->data[0] = '\0';
+    buffer->length = 0;
+    buffer->capacity = capacity;
+}
+
+// makes room for length more bytes and the NUL, doubling the buffer when needed
+void reserve_string(StringBuffer *buffer, size_t length) {
+    if (buffer->length + length + 1 > buffer->capacity) {
+        while (buffer->length + length + 1 > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+}
+
+// appends length bytes of str, the data stays NUL-terminated
+void append_string(StringBuffer *buffer, const char *str, size_t length) {
+    reserve_string(buffer, length);
+    memcpy(buffer->data + buffer->length, str, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+// value of a variable, environment variables win over shell variables
+const char *lookup_variable(ShellVariables *sv, const char *name, size_t length) {
+    char short_name[64];
+    char *var_name = length < sizeof(short_name) ? short_name : malloc(length + 1);
+    memcpy(var_name, name, length);
+    var_name[length] = '\0';
+
+    const char *value = getenv(var_name);
+    if (!value) {
+        value = get_shell_variable(sv, var_name);
+    }
+    if (var_name != short_name) {
+        free(var_name);
+    }
+    return value;
+}
+
+// length of the $( ) starting at pos, up to its matching parenthesis, 0 if it is never closed
+size_t substitution_length(const char *pos) {
+    int depth = 0;
+    for (const char *p = pos + 1; *p != '\0'; p++) {
+        if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p - pos + 1;
+        }
+    }
+    return 0;
+}
+
+// runs command in a forked copy of the shell and reads its output straight into result,
+// the trailing newlines are dropped like in bash
+void capture_output(Shell *shell, const char *command, StringBuffer *result) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    } else if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        shell->interactive = 0; // no job reports in the output
+        execute_line(shell, command);
+        fflush(stdout);
+        _exit(shell->had_error ? 255 : shell->status);
+    }
+    close(fds[1]);
+
+    ssize_t n;
+    do {
+        reserve_string(result, 4096);
+        n = read(fds[0], result->data + result->length, result->capacity - result->length - 1);
+        if (n > 0) {
+            result->length += n;
+        }
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    close(fds[0]);
+    while (result->length > 0 && result->data[result->length - 1] == '\n') {
+        result->length--;
+    }
+    result->data[result->length] = '\0';
+    waitpid(pid, NULL, 0);
 }
 
-void substitute_variables(char *command, ShellVariables *sv) {
-    char temp[MAXLINE] = "";
-    char *pos = command;
+// replaces $name (up to a space or the next $), ${name} and $( ), returns a malloced copy of the line the caller frees
+// shell runs the $( ) commands, with NULL they are kept as written
+char *substitute_variables(const char *command, ShellVariables *sv, Shell *shell) {
+    StringBuffer result;
+    init_string_buffer(&result, strlen(command) + 1);
+
+    const char *pos = command;
     while (*pos) {
-        if (*pos == '$') {
-            pos++;
-            char var_name[MAXLINE] = "";
-            int i = 0;
-            while (*pos && *pos != ' ' && *pos != '$') {
-                var_name[i++] = *pos++;
-            }
-            var_name[i] = '\0';
+        // plain text is copied in one go up to the next $
+        size_t plain = strcspn(pos, "$");
+        append_string(&result, pos, plain);
+        pos += plain;
+        if (*pos != '$') {
+            break;
+        }
+        pos++;
 
-            char *value = getenv(var_name);
-            if (!value) {
-                value = get_shell_variable(sv, var_name);
+        const char *name = pos;
+        size_t length;
+        if (*pos == '(') {
+            length = substitution_length(pos - 1);
+            if (length == 0 || shell == NULL) { // kept as it was
+                append_string(&result, "$", 1);
+                continue;
             }
-            if (value) {
-                strcat(temp, value);
+            char *inner = strndup(pos + 1, length - 3);
+            capture_output(shell, inner, &result);
+            free(inner);
+            pos += length - 1;
+            continue;
+        } else if (*pos == '{') {
+            const char *close = strchr(pos, '}');
+            if (close == NULL) { // not a variable, kept as it was
+                append_string(&result, "$", 1);
+                continue;
             }
+            name = pos + 1;
+            length = close - name;
+            pos = close + 1;
         } else {
-            strncat(temp, pos, 1);
-            pos++;
+            length = strcspn(pos, " $");
+            pos += length;
+        }
+
+        const char *value = lookup_variable(sv, name, length);
+        if (value) {
+            append_string(&result, value, strlen(value));
         }
     }
-    strcpy(command, temp);
+    return result.data;
 }
 
 // built in version of ls, making sure it matches ls -1 like in bash
-void builtin_ls() {
-    DIR *dir;
-    struct dirent *entry;
-    char *entries[MAXARGS];
-    int count = 0;
+// the names are read in large getdents64 batches into one arena, sorted with strcmp (LANG=C) and written at once
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    dir = opendir("."); // getting current dir open
-    if (dir == NULL) {
+void builtin_ls() {
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC); // getting current dir open
+    if (dir_fd == -1) {
         perror("opendir");
         return;
     }
 
-    while ((entry = readdir(dir)) != NULL) { // storing all current contents in our list, skipping hidden files
-        if (entry->d_name[0] != '.') {
-            entries[count] = strdup(entry->d_name);
-            if (entries[count] == NULL) {
-                perror("strdup");
-                closedir(dir);
-                return;
+    StringBuffer names; // NUL-separated names, skipping hidden files
+    init_string_buffer(&names, LSBATCH);
+    int count = 0;
+    char *batch = malloc(LSBATCH);
+    ssize_t n;
+    while ((n = getdents64(dir_fd, batch, LSBATCH)) > 0) {
+        for (ssize_t offset = 0; offset < n; ) {
+            struct dirent64 *entry = (struct dirent64 *)(batch + offset);
+            if (entry->d_name[0] != '.') {
+                append_string(&names, entry->d_name, strlen(entry->d_name) + 1);
+                count++;
             }
-            count++;
+            offset += entry->d_reclen;
         }
     }
-    closedir(dir);
+    if (n == -1) {
+        perror("getdents64");
+    }
+    free(batch);
+    close(dir_fd);
 
-    for (int i = 0; i < count - 1; i++) { // sorting alphabetically to match .out file on test
-        for (int j = i + 1; j < count; j++) {
-            if (strcmp(entries[i], entries[j]) > 0) {
-                char *temp = entries[i];
-                entries[i] = entries[j];
-                entries[j] = temp;
-            }
-        }
+    // the arena does not move any more, so the sort works on pointers into it
+    char **entries = malloc((count > 0 ? count : 1) * sizeof(char *));
+    char *name = names.data;
+    for (int i = 0; i < count; i++) {
+        entries[i] = name;
+        name += strlen(name) + 1;
     }
+    qsort(entries, count, sizeof(char *), compare_names);
+
+    StringBuffer output;
+    init_string_buffer(&output, names.length + 1);
     for (int i = 0; i < count; i++) {
-        printf("%s\n", entries[i]);
-        free(entries[i]);
+        append_string(&output, entries[i], strlen(entries[i]));
+        append_string(&output, "\n", 1);
+    }
+    fflush(stdout); // anything printf'd before must come first
+    for (size_t written = 0; written < output.length; ) {
+        ssize_t w = write(STDOUT_FILENO, output.data + written, output.length - written);
+        if (w <= 0) {
+            perror("ls");
+            break;
+        }
+        written += w;
     }
-}
 
-int main(int argc, char *argv[]) {
-    FILE *input = stdin;
-    char command[MAXLINE];
-    char *args[MAXARGS];
-    int had_error = 0;  // tracking if an error has occurred
+    free(output.data);
+    free(entries);
+    free(names.data);
+}
 
-    ShellVariables shell_vars = {.head = NULL};
-    History history;
-    init_history(&history, DEFAULTHISTORY);
+// the following functions cache where commands live in PATH, like the hash builtin of bash
+// FNV-1a hash of a string
+unsigned int hash_string(const char *str) {
+    unsigned int hash = 2166136261u;
+    for (; *str != '\0'; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    setenv("PATH", "/bin", 1);
+// linear probing, returns the slot holding key or the empty slot where it belongs
+int find_slot(const void *slots, int capacity, const char *key, SlotKey key_at) {
+    int slot = hash_string(key) & (capacity - 1);
+    const char *current;
+    while ((current = key_at(slots, slot)) != NULL && strcmp(current, key) != 0) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
 
-    if (argc > 2) {
-        fprintf(stderr, "Usage: %s [batch file]\n", argv[0]);
-        exit(-1);
-    } else if (argc == 2) {
-        input = fopen(argv[1], "r");
-        if (input == NULL) {
-            perror("Error opening batch file");
-            exit(-1);
+// moves the entries into a zeroed table of capacity slots and frees the old one
+void *grow_slots(void *slots, int old_capacity, int capacity, size_t entry_size, SlotKey key_at) {
+    char *grown = calloc(capacity, entry_size);
+    for (int i = 0; i < old_capacity; i++) {
+        const char *key = key_at(slots, i);
+        if (key != NULL) {
+            memcpy(grown + find_slot(grown, capacity, key, key_at) * entry_size, (char *)slots + i * entry_size, entry_size);
         }
     }
+    free(slots);
+    return grown;
+}
+
+void init_path_cache(PathCache *cache, int capacity) {
+    cache->entries = calloc(capacity, sizeof(PathCacheEntry));
+    cache->capacity = capacity;
+    cache->size = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+// forgets every cached path but keeps the hit/miss counters
+void clear_path_cache(PathCache *cache) {
+    for (int i = 0; i < cache->capacity; i++) {
+        free(cache->entries[i].name);
+        free(cache->entries[i].path);
+    }
+    memset(cache->entries, 0, cache->capacity * sizeof(PathCacheEntry));
+    cache->size = 0;
+}
 
-    while (1) {
-        if (input == stdin) {
-            printf("wsh> ");
-            fflush(stdout);
-        }
+void free_path_cache(PathCache *cache) {
+    clear_path_cache(cache);
+    free(cache->entries);
+}
+
+const char *path_cache_key(const void *entries, int i) {
+    return ((const PathCacheEntry *)entries)[i].name;
+}
+
+PathCacheEntry *find_path_cache_slot(PathCache *cache, const char *name) {
+    return &cache->entries[find_slot(cache->entries, cache->capacity, name, path_cache_key)];
+}
+
+// walks PATH for an executable called name, returns a malloced path or NULL
+char *search_path(const char *name) {
+    char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        return NULL;
+    }
 
-        if (fgets(command, MAXLINE, input) == NULL) {
+    char *directories = strdup(path_env); // strtok must not cut up the environment of the shell
+    char *directory = strtok(directories, ":");
+    char cmd_path[PATH_MAX];
+    char *found = NULL;
+
+    while (directory != NULL) {
+        // a truncated path could name another program, such paths could not be run anyway
+        int length = snprintf(cmd_path, sizeof(cmd_path), "%s/%s", directory, name);
+        if (length < (int)sizeof(cmd_path) && access(cmd_path, X_OK) == 0) {
+            found = strdup(cmd_path);
             break;
         }
+        directory = strtok(NULL, ":");
+    }
+    free(directories);
+    return found;
+}
+
+// absolute path of a command, only probing PATH the first time it is seen
+const char *lookup_command(PathCache *cache, const char *name) {
+    PathCacheEntry *entry = find_path_cache_slot(cache, name);
+    if (entry->name != NULL) {
+        entry->hits++;
+        cache->hits++;
+        return entry->path;
+    }
 
-        command[strcspn(command, "\n")] = '\0';
+    cache->misses++;
+    char *path = search_path(name);
+    if (path == NULL) { // commands that are not found are not cached, they may be installed later
+        return NULL;
+    }
 
-        if (command[0] == '\0') {
-            continue;
+    if ((cache->size + 1) * 2 > cache->capacity) { // keeping the load factor <= 1/2
+        cache->entries = grow_slots(cache->entries, cache->capacity, cache->capacity * 2, sizeof(PathCacheEntry), path_cache_key);
+        cache->capacity *= 2;
+        entry = find_path_cache_slot(cache, name);
+    }
+
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    cache->size++;
+    return path;
+}
+
+void print_path_cache(const PathCache *cache) {
+    if (cache->size == 0) {
+        printf("hash: hash table empty\n");
+    } else {
+        printf("hits\tcommand\n");
+        for (int i = 0; i < cache->capacity; i++) {
+            if (cache->entries[i].name != NULL) {
+                printf("%4d\t%s\n", cache->entries[i].hits, cache->entries[i].path);
+            }
         }
+    }
+    printf("hash: %ld hits, %ld misses\n", cache->hits, cache->misses);
+}
 
-        char *trimmed = command;
-        while (*trimmed == ' ') {
-            trimmed++;
+// the following functions keep track of pipelines started in the background with &
+// job ids are the slot index + 1, a slot is free when its command is NULL
+Job *add_job(Shell *shell, const char *command) {
+    for (int i = 0; i < MAXJOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->command == NULL) {
+            job->id = i + 1;
+            job->command = strdup(command);
+            job->count = 0;
+            job->remaining = 0;
+            job->stopped = 0;
+            job->last_status = 0;
+            job->pgid = 0;
+            job->order = ++shell->job_order;
+            return job;
         }
-        if (trimmed[0] == '#') {
-            continue;
+    }
+    return NULL;
+}
+
+void free_job(Job *job) {
+    free(job->command);
+    job->command = NULL;
+}
+
+// records what happened to one stage of a job
+void update_job_stage(Job *job, int stage, int status) {
+    if (WIFSTOPPED(status)) {
+        job->stopped = 1;
+    } else if (WIFCONTINUED(status)) {
+        job->stopped = 0;
+    } else {
+        job->pids[stage] = -1;
+        job->remaining--;
+        if (stage == job->count - 1) {
+            job->last_status = WIFEXITED(status) && WEXITSTATUS(status) == 255;
         }
+    }
+}
 
-        substitute_variables(command, &shell_vars);
+// empties the signalfd, a SIGCHLD read here stays pending in the shell until update_jobs has polled the jobs
+// children are reaped in order and not right away, so the profile notes here when each one exited
+void drain_child_signals(Shell *shell) {
+    struct signalfd_siginfo info;
+    int pending = 0;
+    while (read(shell->child_fd, &info, sizeof(info)) == sizeof(info)) {
+        pending = 1;
+    }
+    if (pending) {
+        shell->child_pending = 1;
+        if (shell->profile.enabled) {
+            profile_note_exits(&shell->profile);
+        }
+    }
+}
 
-        // checking builtin commands, excluding them from being included in history
-        if (strncmp(trimmed, "history", 7) != 0 && strcmp(trimmed, "exit") != 0 &&
-            strncmp(trimmed, "cd", 2) != 0 && strncmp(trimmed, "local", 5) != 0 &&
-            strncmp(trimmed, "export", 6) != 0 && strncmp(trimmed, "vars", 4) != 0 &&
-            strcmp(trimmed, "ls") != 0) {
-            add_to_history(&history, trimmed);
-        }
-
-        int arg_count = 0;
-        char *redirection_file = NULL;
-        int redirect_type = 0;
-
-        char *token = strtok(command, " ");
-        while (token != NULL) {
-            if (strncmp(token, "2>", 2) == 0) {
-                redirect_type = 6; // stderr overwrite redirection
-                redirection_file = token + 2;
-                if (*redirection_file == '\0') { // if no file name is directly attached, get the next token
-                    token = strtok(NULL, " ");
-                    if (token) {
-                        redirection_file = token;
-                    }
-                }
-            } else if (strstr(token, ">>") != NULL) {
-                if (strncmp(token, "&>>", 3) == 0) {
-                    redirect_type = 5;
-                    redirection_file = token + 3;
-                } else {
-                    redirect_type = 3;
-                    redirection_file = token + 2;
-                }
-            } else if (strstr(token, "&>") != NULL) {
-                redirect_type = 4;
-                redirection_file = token + 2;
-            } else if (strchr(token, '>') != NULL) {
-                redirect_type = 2;
-                redirection_file = token + 1;
-            } else if (strchr(token, '<') != NULL) {
-                redirect_type = 1;
-                redirection_file = token + 1;
-            } else {
-                args[arg_count] = token;
-                arg_count++;
-            }
-            token = strtok(NULL, " ");
+// polls the stages of every job, only after a SIGCHLD arrived and only for our own pids
+void update_jobs(Shell *shell) {
+    // SIGCHLD is only read from the signalfd, without one every job is polled
+    if (shell->child_fd != -1) {
+        drain_child_signals(shell);
+        if (!shell->child_pending) {
+            return;
         }
-        args[arg_count] = NULL;
+        shell->child_pending = 0;
+    }
 
-        if (strcmp(args[0], "exit") == 0) {
-            if (arg_count > 1) {
-                fprintf(stderr, "exit: too many arguments\n");
-                continue;
-            }
-            break;
-        } else if (strcmp(args[0], "cd") == 0) {
-            if (arg_count != 2) {
-                fprintf(stderr, "cd: expected one argument\n");
-                had_error = 1;
-            } else {
-                if (chdir(args[1]) != 0) {
-                    perror("cd");
-                    had_error = 1;
-                } else {
-                    had_error = 0;
-                }
-            }
-            continue;
-        } else if (strcmp(args[0], "local") == 0) {
-            if (arg_count == 2) {
-                char *eq_pos = strchr(args[1], '=');
-                if (eq_pos) {
-                    *eq_pos = '\0';
-                    set_shell_variable(&shell_vars, args[1], eq_pos + 1);
-                    had_error = 0;
-                } else {
-                    fprintf(stderr, "local: invalid format, expected VAR=value\n");
-                    had_error = 1;
-                }
-            } else {
-                fprintf(stderr, "local: expected one argument in VAR=value format\n");
-                had_error = 1;
-            }
-            continue;
-        } else if (strcmp(args[0], "export") == 0) {
-            if (arg_count == 2) {
-                char *eq_pos = strchr(args[1], '=');
-                if (eq_pos) {
-                    *eq_pos = '\0';
-                    if (setenv(args[1], eq_pos + 1, 1) != 0) {
-                        perror("export");
-                        had_error = 1;
-                    } else {
-                        had_error = 0;
-                    }
-                } else {
-                    // handle "export X=" to clear the variable
-                    if (setenv(args[1], "", 1) != 0) {
-                        perror("export");
-                        had_error = 1;
-                    } else {
-                        had_error = 0;
-                    }
-                }
-            } else {
-                fprintf(stderr, "export: expected one argument in VAR=value format\n");
-                had_error = 1;
-            }
-            continue;
-        } else if (strcmp(args[0], "vars") == 0) {
-            if (arg_count > 1) {
-                fprintf(stderr, "vars: too many arguments\n");
-                had_error = 1;
-            } else {
-                ShellVariable *current = shell_vars.head;
-                while (current) {
-                    printf("%s=%s\n", current->name, current->value);
-                    current = current->next;
-                }
-                had_error = 0;
-            }
-            continue;
-        } else if (strcmp(args[0], "history") == 0) {
-            if (arg_count == 1) {
-                print_history(&history);
-                had_error = 0;
-            } else if (arg_count == 3 && strcmp(args[1], "set") == 0) { // accounting for being able to run commands from history
-                int new_capacity = atoi(args[2]);
-                if (new_capacity <= 0) {
-                    fprintf(stderr, "Invalid history size\n");
-                    had_error = 1;
-                } else {
-                    char **new_commands = malloc(new_capacity * sizeof(char *)); // new memory for new history size
-                    if (new_commands == NULL) {
-                        perror("malloc");
-                        had_error = 1;
-                        continue;
-                    }
-                    // copy existing commands so as to not lose them, and free old structure
-                    int copy_count = history.size < new_capacity ? history.size : new_capacity;
-                    for (int i = 0; i < copy_count; i++) {
-                        new_commands[i] = history.commands[i];
-                    }
-                    if (history.size > new_capacity) {
-                        for (int i = new_capacity; i < history.size; i++) {
-                            free(history.commands[i]);
-                        }
-                    }
-
-                    free(history.commands);
-                    history.commands = new_commands;
-                    history.size = copy_count;
-                    history.capacity = new_capacity;
-                    had_error = 0;
-                }
-            } else if (arg_count == 2) {
-                int n = atoi(args[1]);
-                if (n > 0 && n <= history.size) {
-                    int index = history.size - n; // correct index in array of command
-
-                    if (index >= 0 && index < history.size) {
-                        strcpy(command, history.commands[index]); // storing command to run
-                        trimmed = command;
-                        while (*trimmed == ' ') { // no repetitive add of command onto history list
-                            trimmed++;
-                        }
-                        // executing command
-                        pid_t pid = fork();
-                        if (pid < 0) {
-                            perror("fork");
-                            had_error = 1;
-                        } else if (pid == 0) {
-                            // within child process
-                            char *token = strtok(command, " ");
-                            arg_count = 0;
-                            while (token != NULL) {
-                                args[arg_count] = token;
-                                arg_count++;
-                                token = strtok(NULL, " ");
-                            }
-                            args[arg_count] = NULL;
-
-                            if (strchr(args[0], '/') != NULL) {
-                                execv(args[0], args);
-                                perror("execv");
-                                exit(-1);
-                            }
-
-                            char *path_env = getenv("PATH");
-                            if (path_env == NULL) {
-                                perror("getenv");
-                                exit(-1);
-                            }
-
-                            char *directory = strtok(path_env, ":");
-                            char cmd_path[MAXLINE];
-
-                            while (directory != NULL) {
-                                snprintf(cmd_path, sizeof(cmd_path), "%s/%s", directory, args[0]);
-                                if (access(cmd_path, X_OK) == 0) {
-                                    execv(cmd_path, args);
-                                    perror("execv");
-                                    exit(-1);
-                                }
-                                directory = strtok(NULL, ":");
-                            }
-                            perror("execv");
-                            exit(255);
-                        } else {
-                            // within parent process, nonzero return code (PID of parent I believe)
-                            int status;
-                            wait(&status);
-                            if (WIFEXITED(status)) {
-                                if (WEXITSTATUS(status) == 255) {
-                                    had_error = 1;
-                                } else {
-                                    had_error = 0;
-                                }
-                            }
-                        }
-                    } else {
-                        fprintf(stderr, "Invalid history index\n");
-                        had_error = 1;
-                    }
-                    continue;
-                } else {
-                    fprintf(stderr, "Invalid history index\n");
-                    had_error = 1;
-                }
-            }
+    for (int i = 0; i < MAXJOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->command == NULL) {
             continue;
-        } else if (strcmp(args[0], "ls") == 0) {
-            if (arg_count > 1) {
-                fprintf(stderr, "ls: too many arguments\n");
-                had_error = 1;
-            } else {
-                builtin_ls();
-                had_error = 0;
+        }
+        for (int j = 0; j < job->count; j++) {
+            int status;
+            if (job->pids[j] != -1 && reap_child(shell, job->pids[j], &status, WNOHANG | WUNTRACED | WCONTINUED) > 0) {
+                update_job_stage(job, j, status);
             }
-            continue;
         }
+    }
+}
 
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            had_error = 1;
-        } else if (pid == 0) {
-            int fd = -1;
-            if (redirection_file) {
-                if (redirect_type == 1) {
-                    fd = open(redirection_file, O_RDONLY);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDIN_FILENO);
-                } else if (redirect_type == 2) {
-                    fd = open(redirection_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                } else if (redirect_type == 3) {
-                    fd = open(redirection_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                } else if (redirect_type == 4) {
-                    fd = open(redirection_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                    dup2(fd, STDERR_FILENO);
-                } else if (redirect_type == 5) {
-                    fd = open(redirection_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                    dup2(fd, STDERR_FILENO);
-                } else if (redirect_type == 6) {
-                    fd = open(redirection_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (fd == -1) {
-                        perror("open");
-                        exit(-1);
-                    }
-                    dup2(fd, STDERR_FILENO);
-                }
-                close(fd);
+// blocks until the job is done or stopped, returns 1 if it is done
+int wait_job(Shell *shell, Job *job) {
+    for (int j = 0; j < job->count; j++) {
+        int status;
+        while (job->pids[j] != -1) {
+            if (reap_child(shell, job->pids[j], &status, WUNTRACED) < 0) {
+                perror("waitpid");
+                job->pids[j] = -1;
+                job->remaining--;
+                break;
             }
-
-            if (strchr(args[0], '/') != NULL) {
-                execv(args[0], args);
-                perror("execv");
-                exit(-1);
+            update_job_stage(job, j, status);
+            if (job->stopped) {
+                return 0;
             }
+        }
+    }
+    return 1;
+}
 
-            char *path_env = getenv("PATH");
-            if (path_env == NULL) {
-                perror("getenv");
-                exit(-1);
+void continue_job(Job *job) {
+    if (job->pgid > 0) {
+        kill(-job->pgid, SIGCONT);
+    } else {
+        for (int j = 0; j < job->count; j++) {
+            if (job->pids[j] != -1) {
+                kill(job->pids[j], SIGCONT);
             }
+        }
+    }
+    job->stopped = 0;
+}
 
-            char *directory = strtok(path_env, ":");
-            char cmd_path[MAXLINE];
+const char *job_state(const Job *job) {
+    if (job->remaining == 0) {
+        return "Done";
+    }
+    return job->stopped ? "Stopped" : "Running";
+}
 
-            while (directory != NULL) {
-                snprintf(cmd_path, sizeof(cmd_path), "%s/%s", directory, args[0]);
-                if (access(cmd_path, X_OK) == 0) {
-                    execv(cmd_path, args);
-                    perror("execv");
-                    exit(-1);
-                }
-                directory = strtok(NULL, ":");
+// "%n" or "n" picks job n, no argument picks the most recently started job
+Job *find_job(Shell *shell, const char *spec, const char *builtin) {
+    Job *found = NULL;
+    if (spec == NULL) {
+        for (int i = 0; i < MAXJOBS; i++) {
+            if (shell->jobs[i].command != NULL && (found == NULL || shell->jobs[i].order > found->order)) {
+                found = &shell->jobs[i];
             }
+        }
+        if (found == NULL) {
+            fprintf(stderr, "%s: no current job\n", builtin);
+        }
+        return found;
+    }
 
-            exit(255);
-        } else {
-            int status;
-            wait(&status);
-            if (WIFEXITED(status)) {
-                if (WEXITSTATUS(status) == 255) {
-                    had_error = 1;
-                } else {
-                    had_error = 0;
-                }
-            }
+    int id = atoi(spec[0] == '%' ? spec + 1 : spec);
+    if (id >= 1 && id <= MAXJOBS && shell->jobs[id - 1].command != NULL) {
+        found = &shell->jobs[id - 1];
+    } else {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+    }
+    return found;
+}
+
+// in interactive mode finished jobs are announced before the next prompt, like in bash
+void report_jobs(Shell *shell) {
+    update_jobs(shell);
+    for (int i = 0; i < MAXJOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->command != NULL && job->remaining == 0) {
+            printf("[%d]  Done\t%s\n", job->id, job->command);
+            free_job(job);
         }
     }
+}
 
-    free_shell_variables(&shell_vars);
-    free_history(&history);
-    if (input != stdin) {
-        fclose(input);
+void print_jobs(Shell *shell) {
+    update_jobs(shell);
+    for (int i = 0; i < MAXJOBS; i++) {
+        Job *job = &shell->jobs[i];
+        if (job->command == NULL) {
+            continue;
+        }
+        printf("[%d]  %s\t%s%s\n", job->id, job_state(job), job->command, job->remaining && !job->stopped ? " &" : "");
+        if (job->remaining == 0) { // done jobs are listed once
+            free_job(job);
+        }
     }
+}
 
-    if (had_error) {
-        return -1;
+void free_jobs(Shell *shell) {
+    for (int i = 0; i < MAXJOBS; i++) {
+        if (shell->jobs[i].command != NULL) {
+            free_job(&shell->jobs[i]);
+        }
     }
-    return 0;
-}
\ No newline at end of file
+}
+
+// the following functions account for the time and memory used by children, for time and WSH_PROFILE
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// the summary is written to path when the shell exits
+void init_profile(Profile *profile, const char *path) {
+    profile->enabled = 1;
+    profile->output_path = strdup(path);
+}
+
+// remembers when a child started, taken before it was forked, and which command it runs
+void profile_child_started(Profile *profile, pid_t pid, const char *name, double start) {
+    int index = 0;
+    while (index < profile->command_count && strcmp(profile->commands[index].name, name) != 0) {
+        index++;
+    }
+    if (index == profile->command_count) {
+        if (profile->command_count == profile->command_capacity) {
+            profile->command_capacity = profile->command_capacity ? profile->command_capacity * 2 : 8;
+            profile->commands = realloc(profile->commands, profile->command_capacity * sizeof(CommandProfile));
+        }
+        CommandProfile *command = &profile->commands[profile->command_count++];
+        memset(command, 0, sizeof(*command));
+        command->name = strdup(name);
+    }
+
+    if (profile->child_count == profile->child_capacity) {
+        profile->child_capacity = profile->child_capacity ? profile->child_capacity * 2 : 8;
+        profile->children = realloc(profile->children, profile->child_capacity * sizeof(ProfiledChild));
+    }
+    profile->children[profile->child_count++] = (ProfiledChild){.pid = pid, .command = index, .start = start, .end = 0};
+}
+
+// stamps the children that have exited but are not reaped yet, WNOWAIT leaves them to their waiter
+void profile_note_exits(Profile *profile) {
+    for (int i = 0; i < profile->child_count; i++) {
+        siginfo_t info = {.si_pid = 0};
+        if (profile->children[i].end == 0 &&
+            waitid(P_PID, profile->children[i].pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0) {
+            profile->children[i].end = now_seconds();
+        }
+    }
+}
+
+// adds a finished child to the totals of its command, children the profile did not see start are ignored
+void profile_child_done(Profile *profile, pid_t pid, const struct rusage *usage) {
+    for (int i = 0; i < profile->child_count; i++) {
+        if (profile->children[i].pid != pid) {
+            continue;
+        }
+        CommandProfile *command = &profile->commands[profile->children[i].command];
+        if (command->count == command->capacity) {
+            command->capacity = command->capacity ? command->capacity * 2 : 16;
+            command->samples = realloc(command->samples, command->capacity * sizeof(double));
+        }
+        double end = profile->children[i].end != 0 ? profile->children[i].end : now_seconds();
+        command->samples[command->count++] = end - profile->children[i].start;
+        command->user += timeval_seconds(usage->ru_utime);
+        command->sys += timeval_seconds(usage->ru_stime);
+        if (usage->ru_maxrss > command->max_rss) {
+            command->max_rss = usage->ru_maxrss;
+        }
+        profile->children[i] = profile->children[--profile->child_count];
+        return;
+    }
+}
+
+// waitpid that also hands the resource usage of a child that is gone to the profile
+// when profiling, a blocking wait sleeps on the signalfd instead, so other children exiting meanwhile are noted
+pid_t reap_child(Shell *shell, pid_t pid, int *status, int options) {
+    struct rusage usage;
+    pid_t result;
+    if (shell->profile.enabled && shell->child_fd != -1 && !(options & WNOHANG)) {
+        struct pollfd child = {.fd = shell->child_fd, .events = POLLIN};
+        profile_note_exits(&shell->profile);
+        while ((result = wait4(pid, status, options | WNOHANG, &usage)) == 0) {
+            if (poll(&child, 1, -1) == -1 && errno != EINTR) {
+                result = wait4(pid, status, options, &usage);
+                break;
+            }
+            drain_child_signals(shell);
+        }
+    } else {
+        result = wait4(pid, status, options, &usage);
+    }
+    if (result > 0 && shell->profile.enabled && (WIFEXITED(*status) || WIFSIGNALED(*status))) {
+        profile_child_done(&shell->profile, result, &usage);
+    }
+    return result;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// commands that took the most wall time in total come first
+int compare_command_profiles(const void *a, const void *b) {
+    const CommandProfile *x = a;
+    const CommandProfile *y = b;
+    return (y->total > x->total) - (y->total < x->total);
+}
+
+// one tab-separated row per command, times in milliseconds and the largest resident set in KiB
+void write_profile(Profile *profile) {
+    FILE *output = fopen(profile->output_path, "we");
+    if (output == NULL) {
+        perror("WSH_PROFILE");
+        return;
+    }
+    for (int i = 0; i < profile->command_count; i++) {
+        CommandProfile *command = &profile->commands[i];
+        qsort(command->samples, command->count, sizeof(double), compare_doubles);
+        command->total = 0;
+        for (int s = 0; s < command->count; s++) {
+            command->total += command->samples[s];
+        }
+    }
+    qsort(profile->commands, profile->command_count, sizeof(CommandProfile), compare_command_profiles);
+
+    fprintf(output, "command\tcount\ttotal_ms\tp50_ms\tp99_ms\tuser_ms\tsys_ms\tmax_rss_kb\n");
+    for (int i = 0; i < profile->command_count; i++) {
+        const CommandProfile *command = &profile->commands[i];
+        if (command->count == 0) { // never reaped, like a job still running at exit
+            continue;
+        }
+        // nearest rank, the smallest sample at least p percent of the samples are not above
+        double p50 = command->samples[(command->count * 50 + 99) / 100 - 1];
+        double p99 = command->samples[(command->count * 99 + 99) / 100 - 1];
+        fprintf(output, "%s\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%ld\n", command->name, command->count,
+                command->total * 1e3, p50 * 1e3, p99 * 1e3, command->user * 1e3, command->sys * 1e3, command->max_rss);
+    }
+    fclose(output);
+}
+
+void free_profile(Profile *profile) {
+    for (int i = 0; i < profile->command_count; i++) {
+        free(profile->commands[i].name);
+        free(profile->commands[i].samples);
+    }
+    free(profile->commands);
+    free(profile->children);
+    free(profile->output_path);
+}
+
+// prints the times of a pipeline run with the time prefix like bash does, to the stderr of the shell
+void report_time(double start, const struct rusage *self_before, const struct rusage *children_before) {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    double times[3] = {
+        now_seconds() - start,
+        timeval_seconds(self.ru_utime) - timeval_seconds(self_before->ru_utime) +
+            timeval_seconds(children.ru_utime) - timeval_seconds(children_before->ru_utime),
+        timeval_seconds(self.ru_stime) - timeval_seconds(self_before->ru_stime) +
+            timeval_seconds(children.ru_stime) - timeval_seconds(children_before->ru_stime),
+    };
+    const char *labels[3] = {"real", "user", "sys"};
+    fflush(stdout);
+    fprintf(stderr, "\n");
+    for (int i = 0; i < 3; i++) {
+        int minutes = (int)(times[i] / 60);
+        fprintf(stderr, "%s\t%dm%.3fs\n", labels[i], minutes, times[i] - minutes * 60);
+    }
+}
+
+// the following functions parse a line into a syntax tree, trees are cached by line so they are parsed only once
+// splits the buffer on spaces in place, a ; ending a word is a token of its own
+// and a $( ) stays in one token with its spaces
+char **tokenize(char *buffer, int *count) {
+    static char separator[] = ";";
+    int capacity = 16;
+    char **tokens = malloc(capacity * sizeof(char *));
+    *count = 0;
+    char *pos = buffer;
+    while (*(pos += strspn(pos, " ")) != '\0') {
+        char *token = pos;
+        while (*pos != '\0' && *pos != ' ') {
+            size_t length = pos[0] == '$' && pos[1] == '(' ? substitution_length(pos) : 0;
+            pos += length > 0 ? length : 1;
+        }
+        if (*pos != '\0') {
+            *pos++ = '\0';
+        }
+
+        if (*count + 2 > capacity) {
+            capacity *= 2;
+            tokens = realloc(tokens, capacity * sizeof(char *));
+        }
+        size_t length = strlen(token);
+        if (length > 1 && token[length - 1] == ';') {
+            token[length - 1] = '\0';
+            tokens[(*count)++] = token;
+            tokens[(*count)++] = separator;
+        } else {
+            tokens[(*count)++] = token;
+        }
+    }
+    return tokens;
+}
+
+const char *peek_token(const Parser *parser) {
+    return parser->pos < parser->count ? parser->tokens[parser->pos] : NULL;
+}
+
+// ; and the end of the line end a pipeline
+int is_separator(const char *token) {
+    return token == NULL || strcmp(token, ";") == 0;
+}
+
+int syntax_error(Parser *parser) {
+    const char *token = peek_token(parser);
+    parser->error = token != NULL ? token : "newline";
+    return -1;
+}
+
+CommandNode *add_stage(PipelineNode *node) {
+    node->stages = realloc(node->stages, (node->count + 1) * sizeof(CommandNode));
+    CommandNode *cmd = &node->stages[node->count++];
+    cmd->words = NULL;
+    cmd->word_count = 0;
+    cmd->word_capacity = 0;
+    cmd->redirection_file = NULL;
+    cmd->redirect_type = 0;
+    return cmd;
+}
+
+void add_word(CommandNode *cmd, char *word) {
+    if (cmd->word_count == cmd->word_capacity) {
+        cmd->word_capacity = cmd->word_capacity ? cmd->word_capacity * 2 : 4;
+        cmd->words = realloc(cmd->words, cmd->word_capacity * sizeof(char *));
+    }
+    cmd->words[cmd->word_count++] = word;
+}
+
+// the tokens joined with single spaces, malloced
+char *join_tokens(char **tokens, int count) {
+    StringBuffer text;
+    init_string_buffer(&text, 64);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            append_string(&text, " ", 1);
+        }
+        append_string(&text, tokens[i], strlen(tokens[i]));
+    }
+    return text.data;
+}
+
+// stages split on "|" up to the next ; or the end of the line, a final "&" runs it in the background
+// and a time before the first stage reports how long it took
+int parse_pipeline(Parser *parser, PipelineNode *node) {
+    node->stages = NULL;
+    node->count = 0;
+    node->background = 0;
+    node->timed = 0;
+    node->text = NULL;
+
+    const char *token = peek_token(parser);
+    if (token != NULL && strcmp(token, "time") == 0) {
+        node->timed = 1;
+        parser->pos++;
+    }
+    int first = parser->pos;
+    int end = -1; // position of the &
+    CommandNode *cmd = add_stage(node);
+    while (!is_separator(peek_token(parser))) {
+        char *token = parser->tokens[parser->pos];
+        // redirections are only looked for before a $( ), its command may have its own
+        const char *substitution = strstr(token, "$(");
+        size_t plain = substitution != NULL ? (size_t)(substitution - token) : strlen(token);
+        if (strcmp(token, "|") == 0) {
+            if (cmd->word_count == 0 || node->count == MAXSTAGES) {
+                return syntax_error(parser);
+            }
+            cmd = add_stage(node);
+        } else if (strcmp(token, "&") == 0) {
+            if (cmd->word_count == 0 || !is_separator(parser->pos + 1 < parser->count ? parser->tokens[parser->pos + 1] : NULL)) {
+                return syntax_error(parser);
+            }
+            node->background = 1;
+            end = parser->pos;
+        } else if (plain >= 2 && strncmp(token, "2>", 2) == 0) {
+            cmd->redirect_type = 6; // stderr overwrite redirection
+            cmd->redirection_file = token + 2;
+            // if no file name is directly attached, get the next token
+            if (*cmd->redirection_file == '\0' && !is_separator(parser->pos + 1 < parser->count ? parser->tokens[parser->pos + 1] : NULL)) {
+                parser->pos++;
+                cmd->redirection_file = parser->tokens[parser->pos];
+            }
+        } else if (memmem(token, plain, ">>", 2) != NULL) {
+            if (strncmp(token, "&>>", 3) == 0) {
+                cmd->redirect_type = 5;
+                cmd->redirection_file = token + 3;
+            } else {
+                cmd->redirect_type = 3;
+                cmd->redirection_file = token + 2;
+            }
+        } else if (memmem(token, plain, "&>", 2) != NULL) {
+            cmd->redirect_type = 4;
+            cmd->redirection_file = token + 2;
+        } else if (memchr(token, '>', plain) != NULL) {
+            cmd->redirect_type = 2;
+            cmd->redirection_file = token + 1;
+        } else if (memchr(token, '<', plain) != NULL) {
+            cmd->redirect_type = 1;
+            cmd->redirection_file = token + 1;
+        } else {
+            add_word(cmd, token);
+        }
+        parser->pos++;
+    }
+
+    if (cmd->word_count == 0) {
+        if (node->count > 1) { // nothing after the last |
+            parser->error = "|";
+            return -1;
+        }
+        return syntax_error(parser);
+    }
+    node->text = join_tokens(parser->tokens + first, (end == -1 ? parser->pos : end) - first);
+    return 0;
+}
+
+// ; do list ; done, the end of a loop
+int parse_body(Parser *parser, Node *node) {
+    const char *token = peek_token(parser);
+    if (token == NULL || strcmp(token, ";") != 0) {
+        return syntax_error(parser);
+    }
+    while ((token = peek_token(parser)) != NULL && strcmp(token, ";") == 0) {
+        parser->pos++;
+    }
+    if (token == NULL || strcmp(token, "do") != 0) {
+        return syntax_error(parser);
+    }
+    parser->pos++;
+    if (parse_list(parser, &node->body, "done") != 0) {
+        return -1;
+    }
+    parser->pos++;
+    if (!is_separator(peek_token(parser))) {
+        return syntax_error(parser);
+    }
+    return 0;
+}
+
+int parse_node(Parser *parser, Node *node) {
+    memset(node, 0, sizeof(*node));
+    const char *token = peek_token(parser);
+    if (strcmp(token, "for") == 0) {
+        node->type = NODE_FOR;
+        parser->pos++;
+        if (is_separator(peek_token(parser))) {
+            return syntax_error(parser);
+        }
+        node->variable = parser->tokens[parser->pos++];
+        token = peek_token(parser);
+        if (token == NULL || strcmp(token, "in") != 0) {
+            return syntax_error(parser);
+        }
+        parser->pos++;
+        node->items = parser->tokens + parser->pos;
+        while (!is_separator(peek_token(parser))) {
+            parser->pos++;
+            node->item_count++;
+        }
+        return parse_body(parser, node);
+    } else if (strcmp(token, "while") == 0) {
+        node->type = NODE_WHILE;
+        parser->pos++;
+        if (parse_pipeline(parser, &node->pipeline) != 0) {
+            return -1;
+        }
+        return parse_body(parser, node);
+    } else if (strcmp(token, "do") == 0 || strcmp(token, "done") == 0) {
+        return syntax_error(parser);
+    }
+    node->type = NODE_PIPELINE;
+    return parse_pipeline(parser, &node->pipeline);
+}
+
+// items split on ; up to the keyword end, which is left to the caller, or up to the end of the line if end is NULL
+int parse_list(Parser *parser, NodeList *list, const char *end) {
+    list->nodes = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    while (1) {
+        const char *token;
+        while ((token = peek_token(parser)) != NULL && strcmp(token, ";") == 0) {
+            parser->pos++;
+        }
+        if (token == NULL) {
+            return end == NULL ? 0 : syntax_error(parser);
+        }
+        if (end != NULL && strcmp(token, end) == 0) {
+            return 0;
+        }
+        if (list->count == list->capacity) {
+            list->capacity = list->capacity ? list->capacity * 2 : 2;
+            list->nodes = realloc(list->nodes, list->capacity * sizeof(Node));
+        }
+        // counted before parsing, so a node that failed halfway is freed with the list
+        Node *node = &list->nodes[list->count++];
+        if (parse_node(parser, node) != 0) {
+            return -1;
+        }
+    }
+}
+
+// returns NULL on a syntax error, with *error set to a malloced copy of the token it was found near
+ParsedLine *parse_line(const char *source, char **error) {
+    ParsedLine *parsed = malloc(sizeof(ParsedLine));
+    parsed->buffer = strdup(source);
+    parsed->tokens = tokenize(parsed->buffer, &parsed->token_count);
+
+    Parser parser = {.tokens = parsed->tokens, .count = parsed->token_count, .pos = 0, .error = NULL};
+    if (parse_list(&parser, &parsed->list, NULL) != 0) {
+        *error = strdup(parser.error);
+        free_parsed_line(parsed);
+        return NULL;
+    }
+    return parsed;
+}
+
+void free_pipeline_node(PipelineNode *node) {
+    for (int i = 0; i < node->count; i++) {
+        free(node->stages[i].words);
+    }
+    free(node->stages);
+    free(node->text);
+}
+
+void free_node_list(NodeList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free_pipeline_node(&list->nodes[i].pipeline);
+        free_node_list(&list->nodes[i].body);
+    }
+    free(list->nodes);
+}
+
+void free_parsed_line(ParsedLine *parsed) {
+    free_node_list(&parsed->list);
+    free(parsed->tokens);
+    free(parsed->buffer);
+    free(parsed);
+}
+
+void init_parse_cache(ParseCache *cache, int capacity) {
+    cache->entries = calloc(capacity, sizeof(ParseCacheEntry));
+    cache->capacity = capacity;
+    cache->size = 0;
+}
+
+void clear_parse_cache(ParseCache *cache) {
+    for (int i = 0; i < cache->capacity; i++) {
+        if (cache->entries[i].source != NULL) {
+            free(cache->entries[i].source);
+            free_parsed_line(cache->entries[i].parsed);
+            cache->entries[i].source = NULL;
+        }
+    }
+    cache->size = 0;
+}
+
+void free_parse_cache(ParseCache *cache) {
+    clear_parse_cache(cache);
+    free(cache->entries);
+}
+
+const char *parse_cache_key(const void *entries, int i) {
+    return ((const ParseCacheEntry *)entries)[i].source;
+}
+
+ParseCacheEntry *find_parse_cache_slot(ParseCache *cache, const char *source) {
+    return &cache->entries[find_slot(cache->entries, cache->capacity, source, parse_cache_key)];
+}
+
+// lines with a syntax error are not cached, they are rare and the error has to be printed each time anyway
+ParsedLine *parse_cached(Shell *shell, const char *source, char **error) {
+    ParseCache *cache = &shell->parse_cache;
+    ParseCacheEntry *entry = find_parse_cache_slot(cache, source);
+    if (entry->source != NULL) {
+        return entry->parsed;
+    }
+
+    ParsedLine *parsed = parse_line(source, error);
+    if (parsed == NULL) {
+        return NULL;
+    }
+    // a running loop still uses its tree, so the cache is only flushed between top level lines and grows meanwhile
+    if (cache->size >= MAXPARSECACHE && shell->depth == 0) {
+        clear_parse_cache(cache);
+    } else if ((cache->size + 1) * 2 > cache->capacity) {
+        cache->entries = grow_slots(cache->entries, cache->capacity, cache->capacity * 2, sizeof(ParseCacheEntry), parse_cache_key);
+        cache->capacity *= 2;
+    }
+    entry = find_parse_cache_slot(cache, source);
+    entry->source = strdup(source);
+    entry->parsed = parsed;
+    cache->size++;
+    return parsed;
+}
+
+// whether the line runs a loop, nested loops are always inside one at the top
+int has_loop(Shell *shell, const char *line) {
+    char *error = NULL;
+    ParsedLine *parsed = parse_cached(shell, line, &error);
+    free(error);
+    for (int i = 0; parsed != NULL && i < parsed->list.count; i++) {
+        if (parsed->list.nodes[i].type != NODE_PIPELINE) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// loops opened minus loops closed by the line, the main loop reads on until a loop is closed
+int loop_balance(const char *line) {
+    char *copy = strdup(line);
+    int count;
+    char **tokens = tokenize(copy, &count);
+    int balance = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && strcmp(tokens[i - 1], ";") != 0 && strcmp(tokens[i - 1], "do") != 0) {
+            continue; // only keywords in the place of a command count
+        }
+        if (strcmp(tokens[i], "for") == 0 || strcmp(tokens[i], "while") == 0) {
+            balance++;
+        } else if (strcmp(tokens[i], "done") == 0) {
+            balance--;
+        }
+    }
+    free(tokens);
+    free(copy);
+    return balance;
+}
+
+// the following functions start the commands of a pipeline
+void init_command(Command *cmd) {
+    cmd->args = NULL;
+    cmd->arg_count = 0;
+    cmd->arg_capacity = 0;
+    cmd->redirection_file = NULL;
+    cmd->redirect_type = 0;
+}
+
+// appends arg, args stays NULL terminated for exec
+void add_arg(Command *cmd, char *arg) {
+    if (cmd->arg_count + 1 >= cmd->arg_capacity) {
+        cmd->arg_capacity = cmd->arg_capacity ? cmd->arg_capacity * 2 : 8;
+        cmd->args = realloc(cmd->args, cmd->arg_capacity * sizeof(char *));
+    }
+    cmd->args[cmd->arg_count++] = arg;
+    cmd->args[cmd->arg_count] = NULL;
+}
+
+// frees the argument vectors, the strings in them belong to the expansion
+void free_pipeline(Pipeline *pipeline) {
+    for (int i = 0; i < pipeline->count; i++) {
+        free(pipeline->stages[i].args);
+    }
+    pipeline->count = 0;
+}
+
+// opens the file of the redirection in the shell, returns -1 if there is none or it cannot be opened
+int open_redirection(const Command *cmd) {
+    if (cmd->redirection_file == NULL) {
+        return -1;
+    }
+
+    int fd = -1;
+    if (cmd->redirect_type == 1) {
+        fd = open(cmd->redirection_file, O_RDONLY | O_CLOEXEC);
+    } else if (cmd->redirect_type == 2 || cmd->redirect_type == 4 || cmd->redirect_type == 6) {
+        fd = open(cmd->redirection_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    } else if (cmd->redirect_type == 3 || cmd->redirect_type == 5) {
+        fd = open(cmd->redirection_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (fd == -1) {
+        perror("open");
+    }
+    return fd;
+}
+
+// standard streams replaced by a redirection, returns how many were stored in targets
+int redirection_targets(int redirect_type, int targets[2]) {
+    if (redirect_type == 1) {
+        targets[0] = STDIN_FILENO;
+        return 1;
+    } else if (redirect_type == 2 || redirect_type == 3) {
+        targets[0] = STDOUT_FILENO;
+        return 1;
+    } else if (redirect_type == 4 || redirect_type == 5) {
+        targets[0] = STDOUT_FILENO;
+        targets[1] = STDERR_FILENO;
+        return 2;
+    } else if (redirect_type == 6) {
+        targets[0] = STDERR_FILENO;
+        return 1;
+    }
+    return 0;
+}
+
+// only called in a child, path is what the shell resolved for the command, never returns
+// children leave with _exit so they never flush or rewind stdio streams shared with the shell
+void exec_command(Command *cmd, const char *path) {
+    char **args = cmd->args;
+
+    // the shell blocks SIGCHLD for its signalfd, commands start with no signal blocked
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+
+    if (strchr(args[0], '/') != NULL) {
+        execv(args[0], args);
+        perror("execv");
+        _exit(-1);
+    }
+
+    if (path != NULL) {
+        execv(path, args);
+        perror("execv");
+        _exit(-1);
+    }
+
+    _exit(255);
+}
+
+// starts a stage without copying the shell, the redirections become file actions of the child
+pid_t spawn_command(Command *cmd, const char *path, int input_fd, int output_fd, int redirect_fd, pid_t pgid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    // every descriptor of the shell is close-on-exec, so only the dups survive into the command
+    if (input_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    }
+    if (output_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    }
+    if (redirect_fd != -1) {
+        int targets[2];
+        int count = redirection_targets(cmd->redirect_type, targets);
+        for (int i = 0; i < count; i++) {
+            posix_spawn_file_actions_adddup2(&actions, redirect_fd, targets[i]);
+        }
+    }
+
+    // the shell blocks SIGCHLD for its signalfd, commands start with no signal blocked
+    posix_spawnattr_t attributes;
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &no_signals);
+    if (pgid != -1) {
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attributes, pgid);
+    } else {
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    }
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path != NULL ? path : cmd->args[0], &actions, &attributes, cmd->args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (err != 0) {
+        errno = err;
+        perror("posix_spawn");
+        return -1;
+    }
+    return pid;
+}
+
+// forks a stage, only needed for builtins inside a pipeline since they run shell code in the child
+pid_t fork_command(Shell *shell, Command *cmd, int builtin, const char *path, int input_fd, int output_fd, int redirect_fd, pid_t pgid) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        if (pgid != -1) {
+            setpgid(0, pgid);
+        }
+        if (input_fd != -1) {
+            dup2(input_fd, STDIN_FILENO);
+        }
+        if (output_fd != -1) {
+            dup2(output_fd, STDOUT_FILENO);
+        }
+        if (redirect_fd != -1) {
+            int targets[2];
+            int count = redirection_targets(cmd->redirect_type, targets);
+            for (int i = 0; i < count; i++) {
+                dup2(redirect_fd, targets[i]);
+            }
+        }
+        if (builtin) {
+            run_builtin(shell, cmd);
+            fflush(stdout);
+            _exit(shell->had_error ? 255 : shell->status);
+        }
+        exec_command(cmd, path);
+    }
+    return pid;
+}
+
+// the following functions run small utilities inside the shell instead of spawning the programs
+// they are only used where they behave exactly like the programs, anything else still runs /bin/...
+static const char *utility_builtins[] = {"echo", "cat", "true", "test", "["};
+
+int utility_index(const char *name) {
+    for (int i = 0; i < NUMUTILITIES; i++) {
+        if (strcmp(name, utility_builtins[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// leading echo arguments made only of n, e and E are options, only -n is handled here
+int echo_options(const Command *cmd, int *newline) {
+    int i = 1;
+    *newline = 1;
+    for (; i < cmd->arg_count; i++) {
+        const char *arg = cmd->args[i];
+        if (arg[0] != '-' || arg[1] == '\0' || arg[strspn(arg + 1, "neE") + 1] != '\0') {
+            break;
+        }
+        if (strpbrk(arg, "eE") != NULL) {
+            return -1;
+        }
+        *newline = 0;
+    }
+    return i;
+}
+
+int is_integer(const char *str) {
+    char *end;
+    strtol(str, &end, 10);
+    return str[0] != '\0' && *end == '\0';
+}
+
+// the subset of test handled here, one unary or binary expression with an optional !
+int test_supported(char *const *args, int count) {
+    if (count > 0 && strcmp(args[0], "!") == 0) {
+        args++;
+        count--;
+    }
+    if (count <= 1) {
+        return 1;
+    } else if (count == 2) {
+        return strlen(args[0]) == 2 && args[0][0] == '-' && strchr("nzefdrwxs", args[0][1]) != NULL;
+    } else if (count == 3) {
+        if (strcmp(args[1], "=") == 0 || strcmp(args[1], "!=") == 0) {
+            return 1;
+        }
+        const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (strcmp(args[1], ops[i]) == 0) {
+                return is_integer(args[0]) && is_integer(args[2]);
+            }
+        }
+    }
+    return 0;
+}
+
+// 1 if the expression is true, test_supported must have accepted it
+int evaluate_test(char *const *args, int count) {
+    if (count > 0 && strcmp(args[0], "!") == 0) {
+        return !evaluate_test(args + 1, count - 1);
+    }
+    if (count == 0) {
+        return 0;
+    } else if (count == 1) {
+        return args[0][0] != '\0';
+    } else if (count == 2) {
+        struct stat st;
+        const char *arg = args[1];
+        switch (args[0][1]) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 'e': return stat(arg, &st) == 0;
+        case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+        case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+        case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "=") == 0) {
+        return strcmp(args[0], args[2]) == 0;
+    } else if (strcmp(args[1], "!=") == 0) {
+        return strcmp(args[0], args[2]) != 0;
+    }
+    long a = strtol(args[0], NULL, 10);
+    long b = strtol(args[2], NULL, 10);
+    if (strcmp(args[1], "-eq") == 0) {
+        return a == b;
+    } else if (strcmp(args[1], "-ne") == 0) {
+        return a != b;
+    } else if (strcmp(args[1], "-lt") == 0) {
+        return a < b;
+    } else if (strcmp(args[1], "-le") == 0) {
+        return a <= b;
+    } else if (strcmp(args[1], "-gt") == 0) {
+        return a > b;
+    }
+    return a >= b;
+}
+
+// a lone --help or --version is an option to /bin/echo and /bin/true, not an argument
+int long_option_only(const Command *cmd) {
+    return cmd->arg_count == 2 && (strcmp(cmd->args[1], "--help") == 0 || strcmp(cmd->args[1], "--version") == 0);
+}
+
+// whether the utility would behave like the program for these arguments
+int utility_supported(const Command *cmd) {
+    const char *name = cmd->args[0];
+    if (strcmp(name, "echo") == 0) {
+        int newline;
+        return !long_option_only(cmd) && echo_options(cmd, &newline) != -1;
+    } else if (strcmp(name, "cat") == 0) {
+        for (int i = 1; i < cmd->arg_count; i++) {
+            if (cmd->args[i][0] == '-' && cmd->args[i][1] != '\0') { // options are left to /bin/cat
+                return 0;
+            }
+        }
+        return 1;
+    } else if (strcmp(name, "test") == 0) {
+        return test_supported(cmd->args + 1, cmd->arg_count - 1);
+    } else if (strcmp(name, "[") == 0) {
+        return strcmp(cmd->args[cmd->arg_count - 1], "]") == 0 && test_supported(cmd->args + 1, cmd->arg_count - 2);
+    }
+    return !long_option_only(cmd); // true
+}
+
+void builtin_echo(const Command *cmd) {
+    int newline;
+    int first = echo_options(cmd, &newline);
+    for (int i = first; i < cmd->arg_count; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        fputs(cmd->args[i], stdout);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+}
+
+// copies fd to stdout, returns -1 with errno set on a failed read
+int copy_to_stdout(int fd) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = write(STDOUT_FILENO, buffer + written, n - written);
+            if (w <= 0) {
+                return 0; // like cat, a closed stdout just ends the copy
+            }
+            written += w;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// returns the exit status of cat, 1 if a file could not be copied
+int builtin_cat(const Command *cmd) {
+    int status = 0;
+    fflush(stdout);
+    if (cmd->arg_count == 1 && copy_to_stdout(STDIN_FILENO) != 0) {
+        fprintf(stderr, "cat: -: %s\n", strerror(errno));
+        status = 1;
+    }
+    for (int i = 1; i < cmd->arg_count; i++) {
+        const char *file = cmd->args[i];
+        int fd = strcmp(file, "-") == 0 ? STDIN_FILENO : open(file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || copy_to_stdout(fd) != 0) {
+            fprintf(stderr, "cat: %s: %s\n", file, strerror(errno));
+            status = 1;
+        }
+        if (fd > STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    return status;
+}
+
+// builtins that work on the state of the shell, they are barriers in parallel batch mode
+int is_shell_builtin(const char *name) {
+    static const char *builtins[] = {"exit", "cd", "local", "export", "vars", "history", "hash", "jobs", "fg", "bg", "wait", "enable", "ls"};
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(name, builtins[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// utilities stand in for programs, so they are only used if the program itself would be found in PATH
+int is_builtin(Shell *shell, const Command *cmd) {
+    int utility = utility_index(cmd->args[0]);
+    if (utility != -1) {
+        return !(shell->disabled_utilities & (1 << utility)) && utility_supported(cmd) &&
+               lookup_command(&shell->path_cache, cmd->args[0]) != NULL;
+    }
+    return is_shell_builtin(cmd->args[0]);
+}
+
+// runs cmd if it is a builtin, returns 0 if it is not one
+int run_builtin(Shell *shell, Command *cmd) {
+    char **args = cmd->args;
+    int arg_count = cmd->arg_count;
+
+    if (utility_index(args[0]) != -1) { // the caller checked is_builtin for these
+        // like the programs, a false test or a missing file is not an error of the shell (exit code 1, not 255)
+        shell->status = 0;
+        if (strcmp(args[0], "echo") == 0) {
+            builtin_echo(cmd);
+        } else if (strcmp(args[0], "cat") == 0) {
+            shell->status = builtin_cat(cmd);
+        } else if (strcmp(args[0], "test") == 0) {
+            shell->status = !evaluate_test(args + 1, arg_count - 1);
+        } else if (strcmp(args[0], "[") == 0) {
+            shell->status = !evaluate_test(args + 1, arg_count - 2);
+        }
+        shell->had_error = 0;
+        return 1;
+    }
+
+    if (strcmp(args[0], "exit") == 0) {
+        if (arg_count > 1) {
+            fprintf(stderr, "exit: too many arguments\n");
+            return 1;
+        }
+        shell->should_exit = 1;
+    } else if (strcmp(args[0], "cd") == 0) {
+        if (arg_count != 2) {
+            fprintf(stderr, "cd: expected one argument\n");
+            shell->had_error = 1;
+        } else {
+            if (chdir(args[1]) != 0) {
+                perror("cd");
+                shell->had_error = 1;
+            } else {
+                shell->had_error = 0;
+            }
+        }
+    } else if (strcmp(args[0], "local") == 0) {
+        if (arg_count == 2) {
+            char *eq_pos = strchr(args[1], '=');
+            if (eq_pos) {
+                *eq_pos = '\0';
+                set_shell_variable(&shell->vars, args[1], eq_pos + 1);
+                shell->had_error = 0;
+            } else {
+                fprintf(stderr, "local: invalid format, expected VAR=value\n");
+                shell->had_error = 1;
+            }
+        } else {
+            fprintf(stderr, "local: expected one argument in VAR=value format\n");
+            shell->had_error = 1;
+        }
+    } else if (strcmp(args[0], "export") == 0) {
+        if (arg_count == 2) {
+            char *eq_pos = strchr(args[1], '=');
+            if (eq_pos) {
+                *eq_pos = '\0';
+                if (strcmp(args[1], "PATH") == 0) {
+                    clear_path_cache(&shell->path_cache);
+                }
+                if (setenv(args[1], eq_pos + 1, 1) != 0) {
+                    perror("export");
+                    shell->had_error = 1;
+                } else {
+                    shell->had_error = 0;
+                }
+            } else {
+                // handle "export X=" to clear the variable
+                if (strcmp(args[1], "PATH") == 0) {
+                    clear_path_cache(&shell->path_cache);
+                }
+                if (setenv(args[1], "", 1) != 0) {
+                    perror("export");
+                    shell->had_error = 1;
+                } else {
+                    shell->had_error = 0;
+                }
+            }
+        } else {
+            fprintf(stderr, "export: expected one argument in VAR=value format\n");
+            shell->had_error = 1;
+        }
+    } else if (strcmp(args[0], "vars") == 0) {
+        if (arg_count > 1) {
+            fprintf(stderr, "vars: too many arguments\n");
+            shell->had_error = 1;
+        } else {
+            ShellVariable *current = shell->vars.head;
+            while (current) {
+                printf("%s=%s\n", current->name, current->value);
+                current = current->next;
+            }
+            shell->had_error = 0;
+        }
+    } else if (strcmp(args[0], "history") == 0) {
+        History *history = &shell->history;
+        load_history(history);
+        if (arg_count == 1) {
+            print_history(history);
+            shell->had_error = 0;
+        } else if (arg_count == 3 && strcmp(args[1], "set") == 0) { // accounting for being able to run commands from history
+            int new_capacity = atoi(args[2]);
+            if (new_capacity <= 0) {
+                fprintf(stderr, "Invalid history size\n");
+                shell->had_error = 1;
+                return 1;
+            }
+            resize_history(history, new_capacity);
+            shell->had_error = 0;
+        } else if (arg_count == 2) {
+            int n = atoi(args[1]);
+            if (n > 0 && n <= history->size) {
+                // the stored line goes through the usual execution path, without being added to the history again
+                char *replay = strdup(history_entry(history, n));
+                execute_line(shell, replay);
+                free(replay);
+            } else {
+                fprintf(stderr, "Invalid history index\n");
+                shell->had_error = 1;
+            }
+        }
+    } else if (strcmp(args[0], "hash") == 0) {
+        if (arg_count == 1) {
+            print_path_cache(&shell->path_cache);
+            shell->had_error = 0;
+        } else if (arg_count == 2 && strcmp(args[1], "-r") == 0) {
+            clear_path_cache(&shell->path_cache);
+            shell->had_error = 0;
+        } else {
+            fprintf(stderr, "hash: usage: hash [-r]\n");
+            shell->had_error = 1;
+        }
+    } else if (strcmp(args[0], "jobs") == 0) {
+        if (arg_count > 1) {
+            fprintf(stderr, "jobs: too many arguments\n");
+            shell->had_error = 1;
+        } else {
+            print_jobs(shell);
+            shell->had_error = 0;
+        }
+    } else if (strcmp(args[0], "fg") == 0 || strcmp(args[0], "bg") == 0 || strcmp(args[0], "wait") == 0) {
+        if (arg_count > 2) {
+            fprintf(stderr, "%s: too many arguments\n", args[0]);
+            shell->had_error = 1;
+            return 1;
+        }
+        update_jobs(shell);
+        if (strcmp(args[0], "wait") == 0 && arg_count == 1) { // waiting for every job that is not stopped
+            for (int i = 0; i < MAXJOBS; i++) {
+                Job *job = &shell->jobs[i];
+                if (job->command != NULL && !job->stopped && wait_job(shell, job)) {
+                    free_job(job);
+                }
+            }
+            shell->had_error = 0;
+            return 1;
+        }
+
+        Job *job = find_job(shell, arg_count == 2 ? args[1] : NULL, args[0]);
+        if (job == NULL) {
+            shell->had_error = 1;
+        } else if (strcmp(args[0], "wait") == 0 && job->stopped) { // like bash, wait never resumes a job
+            shell->had_error = 1;
+        } else if (strcmp(args[0], "bg") == 0) {
+            if (job->stopped) {
+                continue_job(job);
+                printf("[%d] %s &\n", job->id, job->command);
+            } else {
+                fprintf(stderr, "bg: job %d already in background\n", job->id);
+            }
+            shell->had_error = 0;
+        } else {
+            // fg hands the terminal to the job, and takes it back once the job is done or stopped
+            int terminal = strcmp(args[0], "fg") == 0 && shell->interactive && job->pgid > 0 && isatty(STDIN_FILENO);
+            if (strcmp(args[0], "fg") == 0) {
+                printf("%s\n", job->command);
+                fflush(stdout);
+            }
+            if (terminal) {
+                tcsetpgrp(STDIN_FILENO, job->pgid);
+            }
+            if (job->stopped) {
+                continue_job(job);
+            }
+            int done = wait_job(shell, job);
+            if (terminal) {
+                tcsetpgrp(STDIN_FILENO, getpgrp());
+            }
+            if (done) {
+                shell->had_error = job->last_status;
+                free_job(job);
+            } else {
+                printf("[%d]  Stopped\t%s\n", job->id, job->command);
+                shell->had_error = 1;
+            }
+        }
+    } else if (strcmp(args[0], "enable") == 0) {
+        if (arg_count == 1) {
+            for (int i = 0; i < NUMUTILITIES; i++) {
+                printf("enable %s%s\n", shell->disabled_utilities & (1 << i) ? "-n " : "", utility_builtins[i]);
+            }
+            shell->had_error = 0;
+            return 1;
+        }
+        int disable = strcmp(args[1], "-n") == 0;
+        shell->had_error = 0;
+        for (int i = 1 + disable; i < arg_count; i++) {
+            int utility = utility_index(args[i]);
+            if (utility == -1) {
+                fprintf(stderr, "enable: %s: not a utility builtin\n", args[i]);
+                shell->had_error = 1;
+            } else if (disable) {
+                shell->disabled_utilities |= 1 << utility;
+            } else {
+                shell->disabled_utilities &= ~(1 << utility);
+            }
+        }
+    } else if (strcmp(args[0], "ls") == 0) {
+        if (arg_count > 1) {
+            fprintf(stderr, "ls: too many arguments\n");
+            shell->had_error = 1;
+        } else {
+            builtin_ls();
+            shell->had_error = 0;
+        }
+    } else {
+        return 0;
+    }
+    shell->status = shell->had_error;
+    return 1;
+}
+
+// starts every stage up front so they all run concurrently, pids[i] is -1 for stages that could not be started
+// a job gets a process group of its own, led by its first stage, which is returned
+// so terminal signals meant for the shell do not reach it, and it may be stopped and continued as a whole
+pid_t start_pipeline(Shell *shell, Pipeline *pipeline, pid_t pids[], int job) {
+    int input_fd = -1; // read end of the pipe feeding the next stage
+    pid_t pgid = job ? 0 : -1;
+
+    // without a terminal to stop it, a job reading the input of the shell would steal its lines
+    if (job && !shell->interactive) {
+        input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    fflush(stdout); // children must not inherit buffered output
+
+    for (int i = 0; i < pipeline->count; i++) {
+        Command *cmd = &pipeline->stages[i];
+        pids[i] = -1;
+        double start = 0;
+
+        int fds[2] = {-1, -1};
+        if (i < pipeline->count - 1 && pipe2(fds, O_CLOEXEC) != 0) {
+            perror("pipe");
+        }
+
+        int redirect_fd = open_redirection(cmd);
+        if (cmd->redirection_file == NULL || redirect_fd != -1) {
+            // commands are resolved in the shell, so the lookups are cached across lines
+            const char *path = NULL;
+            int builtin = is_builtin(shell, cmd);
+            if (!builtin && strchr(cmd->args[0], '/') == NULL) {
+                path = lookup_command(&shell->path_cache, cmd->args[0]);
+            }
+            start = shell->profile.enabled ? now_seconds() : 0; // fork and exec count towards the run
+
+#ifdef WSH_FORK_ONLY
+            pids[i] = fork_command(shell, cmd, builtin, path, input_fd, fds[1], redirect_fd, pgid);
+#else
+            if (builtin) {
+                pids[i] = fork_command(shell, cmd, builtin, path, input_fd, fds[1], redirect_fd, pgid);
+            } else if (path != NULL || strchr(cmd->args[0], '/') != NULL) {
+                pids[i] = spawn_command(cmd, path, input_fd, fds[1], redirect_fd, pgid);
+            }
+#endif
+        }
+        if (pids[i] != -1 && pgid != -1) {
+            setpgid(pids[i], pgid == 0 ? pids[i] : pgid); // also in the parent, so the group exists once this returns
+            if (pgid == 0) {
+                pgid = pids[i];
+            }
+        }
+
+        if (pids[i] != -1 && shell->profile.enabled) {
+            profile_child_started(&shell->profile, pids[i], cmd->args[0], start);
+        }
+        if (redirect_fd != -1) {
+            close(redirect_fd);
+        }
+        if (input_fd != -1) {
+            close(input_fd);
+        }
+        if (fds[1] != -1) {
+            close(fds[1]);
+        }
+        input_fd = fds[0];
+    }
+    if (input_fd != -1) {
+        close(input_fd);
+    }
+    return pgid > 0 ? pgid : 0;
+}
+
+// reaps every stage of a pipeline running in the foreground
+void wait_pipeline(Shell *shell, pid_t pids[], int count) {
+    for (int i = 0; i < count; i++) {
+        int status;
+        if (pids[i] == -1) {
+            if (i == count - 1) {
+                shell->had_error = 1;
+                shell->status = 127;
+            }
+            continue;
+        }
+        if (reap_child(shell, pids[i], &status, 0) < 0) {
+            perror("waitpid");
+            continue;
+        }
+        // only the last stage decides the status of the pipeline
+        if (i == count - 1 && WIFEXITED(status)) {
+            shell->status = WEXITSTATUS(status);
+            if (WEXITSTATUS(status) == 255) {
+                shell->had_error = 1;
+            } else {
+                shell->had_error = 0;
+            }
+        } else if (i == count - 1 && WIFSIGNALED(status)) {
+            shell->status = 128 + WTERMSIG(status);
+        }
+    }
+}
+
+// starts the pipeline as a job and returns right away, source is the line without the &
+void run_background(Shell *shell, Pipeline *pipeline, const char *source) {
+    update_jobs(shell);
+    Job *job = add_job(shell, source);
+    if (job == NULL) {
+        fprintf(stderr, "wsh: too many jobs\n");
+        shell->had_error = 1;
+        return;
+    }
+
+    job->pgid = start_pipeline(shell, pipeline, job->pids, 1);
+    job->count = pipeline->count;
+    for (int i = 0; i < job->count; i++) {
+        if (job->pids[i] != -1) {
+            job->remaining++;
+        }
+    }
+    job->last_status = job->pids[job->count - 1] == -1;
+
+    if (shell->interactive) {
+        printf("[%d] %d\n", job->id, (int)job->pids[job->count - 1]);
+    }
+    shell->had_error = 0;
+}
+
+// the redirection is applied to the descriptors of the shell itself and undone once the builtin returns
+void run_builtin_in_shell(Shell *shell, Command *cmd) {
+    int redirect_fd = open_redirection(cmd);
+    if (cmd->redirection_file != NULL && redirect_fd == -1) {
+        shell->had_error = 1;
+        shell->status = 1;
+        return;
+    }
+
+    int targets[2];
+    int saved[2];
+    int count = redirect_fd == -1 ? 0 : redirection_targets(cmd->redirect_type, targets);
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < count; i++) {
+        saved[i] = fcntl(targets[i], F_DUPFD_CLOEXEC, 10);
+        dup2(redirect_fd, targets[i]);
+    }
+    if (redirect_fd != -1) {
+        close(redirect_fd);
+    }
+
+    run_builtin(shell, cmd);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < count; i++) {
+        dup2(saved[i], targets[i]);
+        close(saved[i]);
+    }
+}
+
+// the following functions run a syntax tree, expanding its words each time
+char *keep_string(StringList *list, char *str) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->strings = realloc(list->strings, list->capacity * sizeof(char *));
+    }
+    list->strings[list->count++] = str;
+    return str;
+}
+
+void free_string_list(StringList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->strings[i]);
+    }
+    free(list->strings);
+    list->strings = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// adds the fields of word to fields, a word with a $ is split on the blanks of its value and may vanish
+void expand_word(Shell *shell, const char *word, int split, StringList *fields) {
+    if (strchr(word, '$') == NULL) {
+        keep_string(fields, strdup(word));
+        return;
+    }
+    char *value = substitute_variables(word, &shell->vars, shell);
+    if (!split) {
+        keep_string(fields, value);
+        return;
+    }
+    char *save;
+    for (char *field = strtok_r(value, " \t\n", &save); field != NULL; field = strtok_r(NULL, " \t\n", &save)) {
+        keep_string(fields, strdup(field));
+    }
+    free(value);
+}
+
+// builds the pipeline to run from the tree, returns -1 if a stage was left without a command
+// either way the caller frees it with free_pipeline
+int expand_pipeline(Shell *shell, const PipelineNode *node, Pipeline *pipeline, StringList *expanded) {
+    pipeline->count = 0;
+    pipeline->background = node->background;
+    for (int i = 0; i < node->count; i++) {
+        const CommandNode *stage = &node->stages[i];
+        Command *cmd = &pipeline->stages[pipeline->count++];
+        init_command(cmd);
+        for (int w = 0; w < stage->word_count; w++) {
+            int first = expanded->count;
+            expand_word(shell, stage->words[w], 1, expanded);
+            for (int f = first; f < expanded->count; f++) {
+                add_arg(cmd, expanded->strings[f]);
+            }
+        }
+        if (stage->redirection_file != NULL) {
+            expand_word(shell, stage->redirection_file, 0, expanded);
+            cmd->redirection_file = expanded->strings[expanded->count - 1];
+            cmd->redirect_type = stage->redirect_type;
+        }
+        if (cmd->arg_count == 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void run_pipeline_node(Shell *shell, const PipelineNode *node) {
+    Pipeline pipeline;
+    StringList expanded = {.strings = NULL, .count = 0, .capacity = 0};
+    struct rusage self_before, children_before;
+    double start = 0;
+    if (node->timed) {
+        start = now_seconds();
+        getrusage(RUSAGE_SELF, &self_before);
+        getrusage(RUSAGE_CHILDREN, &children_before);
+    }
+    if (expand_pipeline(shell, node, &pipeline, &expanded) != 0) {
+        if (node->count > 1) {
+            fprintf(stderr, "wsh: syntax error near |\n");
+            shell->had_error = 1;
+            shell->status = 2;
+        }
+        // a single command made only of empty variables does nothing, like a blank line
+    } else if (pipeline.background) {
+        run_background(shell, &pipeline, node->text);
+    } else if (pipeline.count == 1 && is_builtin(shell, &pipeline.stages[0])) {
+        // builtins alone on a line change the state of the shell itself, so they are not forked
+        run_builtin_in_shell(shell, &pipeline.stages[0]);
+    } else {
+        pid_t pids[MAXSTAGES];
+        start_pipeline(shell, &pipeline, pids, 0);
+        wait_pipeline(shell, pids, pipeline.count);
+    }
+    free_pipeline(&pipeline);
+    free_string_list(&expanded);
+    if (node->timed) {
+        report_time(start, &self_before, &children_before);
+    }
+}
+
+void execute_node(Shell *shell, const Node *node) {
+    if (node->type == NODE_PIPELINE) {
+        run_pipeline_node(shell, &node->pipeline);
+    } else if (node->type == NODE_FOR) {
+        StringList items = {.strings = NULL, .count = 0, .capacity = 0};
+        for (int i = 0; i < node->item_count; i++) {
+            expand_word(shell, node->items[i], 1, &items);
+        }
+        shell->status = 0;
+        for (int i = 0; i < items.count && !shell->should_exit; i++) {
+            set_shell_variable(&shell->vars, node->variable, items.strings[i]);
+            execute_list(shell, &node->body);
+        }
+        free_string_list(&items);
+    } else if (node->type == NODE_WHILE) {
+        while (!shell->should_exit) {
+            run_pipeline_node(shell, &node->pipeline);
+            if (shell->status != 0) {
+                break;
+            }
+            execute_list(shell, &node->body);
+        }
+        // a loop that ran to its end is not an error, the false condition only stops it
+        shell->had_error = 0;
+        shell->status = 0;
+    }
+}
+
+void execute_list(Shell *shell, const NodeList *list) {
+    for (int i = 0; i < list->count && !shell->should_exit; i++) {
+        execute_node(shell, &list->nodes[i]);
+    }
+}
+
+// runs one line, its variables are substituted as each command starts
+void execute_line(Shell *shell, const char *line) {
+    char *error = NULL;
+    ParsedLine *parsed = parse_cached(shell, line, &error);
+    if (parsed == NULL) {
+        fprintf(stderr, "wsh: syntax error near %s\n", error);
+        free(error);
+        shell->had_error = 1;
+        shell->status = 2;
+        return;
+    }
+    shell->depth++;
+    execute_list(shell, &parsed->list);
+    shell->depth--;
+}
+
+// the following functions run the lines of a batch file in parallel with -j
+void init_parallel_batch(ParallelBatch *batch, int capacity) {
+    batch->lines = malloc(capacity * sizeof(ParallelLine));
+    batch->capacity = capacity;
+    batch->start = 0;
+    batch->count = 0;
+}
+
+void free_parallel_batch(ParallelBatch *batch) {
+    free(batch->lines);
+}
+
+// writes everything buffered in from_fd to to_fd
+void copy_output(int from_fd, int to_fd) {
+    char buffer[8192];
+    ssize_t n;
+    lseek(from_fd, 0, SEEK_SET);
+    while ((n = read(from_fd, buffer, sizeof(buffer))) > 0) {
+        if (write(to_fd, buffer, n) != n) {
+            break;
+        }
+    }
+}
+
+// waits for the oldest line and prints its output, so output keeps the order of the batch file
+void finish_parallel_line(Shell *shell, ParallelBatch *batch) {
+    ParallelLine *line = &batch->lines[batch->start];
+    wait_pipeline(shell, line->pids, line->count);
+
+    fflush(stdout);
+    copy_output(line->output_fd, STDOUT_FILENO);
+    copy_output(line->error_fd, STDERR_FILENO);
+    close(line->output_fd);
+    close(line->error_fd);
+
+    batch->start = (batch->start + 1) % batch->capacity;
+    batch->count--;
+}
+
+void drain_parallel_batch(Shell *shell, ParallelBatch *batch) {
+    while (batch->count > 0) {
+        finish_parallel_line(shell, batch);
+    }
+}
+
+// opens the stdout and stderr buffers of a line and saves the descriptors of the shell they replace,
+// returns -1 with every fd set to -1 if they cannot all be opened
+int open_line_buffers(int fds[4]) {
+    fds[0] = memfd_create("wsh-stdout", MFD_CLOEXEC);
+    fds[1] = memfd_create("wsh-stderr", MFD_CLOEXEC);
+    fds[2] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    fds[3] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fds[0] != -1 && fds[1] != -1 && fds[2] != -1 && fds[3] != -1) {
+        return 0;
+    }
+    int err = errno;
+    for (int i = 0; i < 4; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+        fds[i] = -1;
+    }
+    errno = err;
+    return -1;
+}
+
+// each line in flight keeps its two buffers open, the rest of the descriptors are left to the shell and the stages
+int max_parallel_lines(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return MAXPARALLEL;
+    }
+    long lines = ((long)limit.rlim_cur - PARALLELRESERVEDFDS) / 2;
+    return lines < 1 ? 1 : lines < MAXPARALLEL ? (int)lines : MAXPARALLEL;
+}
+
+// starts a line without waiting for it, builtins, background jobs, loops, time, $( ) and redirections are barriers
+// run in order in the shell
+void run_parallel_line(Shell *shell, ParallelBatch *batch, const char *line) {
+    char *error = NULL;
+    ParsedLine *parsed = parse_cached(shell, line, &error);
+    if (parsed != NULL && parsed->list.count == 0) {
+        return;
+    }
+
+    // the tree is expanded here to see what the line runs, a variable may hold the name of a builtin
+    Pipeline pipeline = {.count = 0};
+    StringList expanded = {.strings = NULL, .count = 0, .capacity = 0};
+    const Node *node = parsed != NULL ? &parsed->list.nodes[0] : NULL;
+    // a $( ) would run before the lines it may depend on are done
+    int barrier = node == NULL || parsed->list.count != 1 || node->type != NODE_PIPELINE || node->pipeline.background ||
+                  node->pipeline.timed || strstr(line, "$(") != NULL ||
+                  expand_pipeline(shell, &node->pipeline, &pipeline, &expanded) != 0 ||
+                  (pipeline.count == 1 && is_shell_builtin(pipeline.stages[0].args[0]));
+    // a redirected file may be written or read by the lines around it, so these lines keep their place too
+    for (int i = 0; i < pipeline.count && !barrier; i++) {
+        barrier = pipeline.stages[i].redirection_file != NULL;
+    }
+    if (barrier) {
+        free(error);
+        free_pipeline(&pipeline);
+        free_string_list(&expanded);
+        drain_parallel_batch(shell, batch);
+        execute_line(shell, line);
+        return;
+    }
+
+    if (batch->count == batch->capacity) {
+        finish_parallel_line(shell, batch);
+    }
+    // when descriptors run out, the lines in flight are finished to free theirs
+    int fds[4];
+    if (open_line_buffers(fds) != 0 && batch->count > 0) {
+        drain_parallel_batch(shell, batch);
+        open_line_buffers(fds);
+    }
+    if (fds[0] == -1) { // no buffers, so the line runs on its own
+        perror("wsh: buffering output");
+        free_pipeline(&pipeline);
+        free_string_list(&expanded);
+        execute_line(shell, line);
+        return;
+    }
+    ParallelLine *slot = &batch->lines[(batch->start + batch->count) % batch->capacity];
+    slot->output_fd = fds[0];
+    slot->error_fd = fds[1];
+    int saved_output = fds[2];
+    int saved_error = fds[3];
+
+    // the stages inherit the buffers as stdout and stderr, like do the errors printed while starting them
+    fflush(stdout);
+    dup2(slot->output_fd, STDOUT_FILENO);
+    dup2(slot->error_fd, STDERR_FILENO);
+    start_pipeline(shell, &pipeline, slot->pids, 0);
+    dup2(saved_output, STDOUT_FILENO);
+    dup2(saved_error, STDERR_FILENO);
+    close(saved_output);
+    close(saved_error);
+
+    slot->count = pipeline.count;
+    batch->count++;
+    free_pipeline(&pipeline);
+    free_string_list(&expanded);
+}
+
+// the following functions read the input of the shell, waiting on it and on finished children together
+void init_line_reader(LineReader *reader, int fd) {
+    reader->fd = fd;
+    init_string_buffer(&reader->buffer, 4096);
+    reader->start = 0;
+    reader->eof = 0;
+}
+
+void free_line_reader(LineReader *reader) {
+    free(reader->buffer.data);
+}
+
+// blocks until fd can be read, background jobs that finish meanwhile are reaped right away
+void wait_for_input(Shell *shell, int fd) {
+    struct pollfd fds[2] = {{.fd = fd, .events = POLLIN}, {.fd = shell->child_fd, .events = POLLIN}};
+    int count = shell->child_fd != -1 ? 2 : 1;
+    // a SIGCHLD read while a foreground command was waited for does not wake poll again
+    if (shell->child_pending) {
+        update_jobs(shell);
+    }
+    while (1) {
+        if (poll(fds, count, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+        if (count == 2 && (fds[1].revents & POLLIN)) {
+            update_jobs(shell);
+        }
+        if (fds[0].revents != 0) { // data, the end of the input or an error, read tells which
+            return;
+        }
+    }
+}
+
+// returns the next line without its newline, valid until the next call, or NULL at the end of the input
+char *read_line(Shell *shell, LineReader *reader) {
+    StringBuffer *buffer = &reader->buffer;
+    size_t scanned = 0; // bytes after start known to have no newline
+    while (1) {
+        char *newline = memchr(buffer->data + reader->start + scanned, '\n', buffer->length - reader->start - scanned);
+        if (newline != NULL) {
+            char *line = buffer->data + reader->start;
+            *newline = '\0';
+            reader->start = newline - buffer->data + 1;
+            return line;
+        }
+        scanned = buffer->length - reader->start;
+        if (reader->eof) { // a last line without a newline
+            if (scanned == 0) {
+                return NULL;
+            }
+            char *line = buffer->data + reader->start;
+            reader->start = buffer->length;
+            return line;
+        }
+
+        // the lines already returned are dropped only when more input is needed
+        if (reader->start > 0) {
+            memmove(buffer->data, buffer->data + reader->start, scanned);
+            buffer->length = scanned;
+            reader->start = 0;
+        }
+        wait_for_input(shell, reader->fd);
+        reserve_string(buffer, 4096);
+        ssize_t n = read(reader->fd, buffer->data + buffer->length, buffer->capacity - buffer->length - 1);
+        if (n > 0) {
+            buffer->length += n;
+        } else if (n == 0) {
+            reader->eof = 1;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            perror("read");
+            reader->eof = 1;
+        }
+        buffer->data[buffer->length] = '\0';
+    }
+}
+
+#ifndef WSH_NO_MAIN
+int main(int argc, char *argv[]) {
+    int input_fd = STDIN_FILENO;
+    LineReader input;
+
+    Shell shell = {.vars = {.head = NULL}, .had_error = 0, .should_exit = 0, .job_order = 0, .child_fd = -1, .child_pending = 0};
+    init_history(&shell.history, DEFAULTHISTORY);
+    init_path_cache(&shell.path_cache, DEFAULTPATHCACHE);
+    init_parse_cache(&shell.parse_cache, DEFAULTPARSECACHE);
+
+    setenv("PATH", "/bin", 1);
+
+    const char *program = argv[0];
+    int parallel_jobs = 0; // lines run at once with -j, 0 runs them one after the other
+    int bad_jobs = 0;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        parallel_jobs = atoi(argv[2]);
+        bad_jobs = parallel_jobs < 1 || parallel_jobs > MAXPARALLEL;
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc > 2 || bad_jobs || (parallel_jobs > 0 && argc != 2)) {
+        fprintf(stderr, "Usage: %s [-j jobs] [batch file]\n", program);
+        exit(-1);
+    } else if (argc == 2) {
+        input_fd = open(argv[1], O_RDONLY | O_CLOEXEC); // commands must not inherit the batch file
+        if (input_fd == -1) {
+            perror("Error opening batch file");
+            exit(-1);
+        }
+    }
+
+    shell.interactive = input_fd == STDIN_FILENO;
+    if (shell.interactive) {
+        signal(SIGTTOU, SIG_IGN); // so the shell can take the terminal back from a job with tcsetpgrp
+    }
+    init_line_reader(&input, input_fd);
+    // like in bash, only interactive shells keep a history file
+    const char *history_file = getenv("WSH_HISTFILE");
+    if (shell.interactive && history_file != NULL && history_file[0] != '\0') {
+        open_history_file(&shell.history, history_file);
+    }
+    const char *profile_file = getenv("WSH_PROFILE");
+    if (profile_file != NULL && profile_file[0] != '\0') {
+        init_profile(&shell.profile, profile_file);
+    }
+    ParallelBatch batch;
+    if (parallel_jobs > max_parallel_lines()) { // more would fail for lack of descriptors
+        parallel_jobs = max_parallel_lines();
+    }
+    init_parallel_batch(&batch, parallel_jobs > 0 ? parallel_jobs : 1);
+
+    // SIGCHLD is read from a signalfd, so the shell can wait for input and for children at once
+    sigset_t child_signals;
+    sigemptyset(&child_signals);
+    sigaddset(&child_signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &child_signals, NULL);
+    shell.child_fd = signalfd(-1, &child_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (shell.child_fd == -1) {
+        perror("signalfd");
+    }
+
+    while (!shell.should_exit) {
+        if (shell.interactive) {
+            report_jobs(&shell);
+            printf("wsh> ");
+            fflush(stdout);
+        }
+
+        char *command = read_line(&shell, &input);
+        if (command == NULL) {
+            break;
+        }
+
+        if (command[0] == '\0') {
+            continue;
+        }
+
+        char *trimmed = command;
+        while (*trimmed == ' ') {
+            trimmed++;
+        }
+        if (trimmed[0] == '#') {
+            continue;
+        }
+
+        // a loop goes on over the next lines until its done, they are joined into one line with ;
+        StringBuffer loop = {.data = NULL};
+        int balance = loop_balance(trimmed);
+        if (balance > 0) {
+            init_string_buffer(&loop, MAXLINE);
+            append_string(&loop, trimmed, strlen(trimmed));
+            while (balance > 0) {
+                if (shell.interactive) {
+                    printf("> ");
+                    fflush(stdout);
+                }
+                command = read_line(&shell, &input);
+                if (command == NULL) {
+                    break; // the missing done is reported as a syntax error
+                }
+                char *next = command + strspn(command, " ");
+                if (next[0] == '\0' || next[0] == '#') {
+                    continue;
+                }
+                append_string(&loop, " ; ", 3);
+                append_string(&loop, next, strlen(next));
+                balance += loop_balance(next);
+            }
+            trimmed = loop.data;
+        }
+
+        // the history shows the line with its variables substituted
+        // loops are kept as written, whether they were typed on one line or several
+        char *line = has_loop(&shell, trimmed) ? strdup(trimmed) : substitute_variables(trimmed, &shell.vars, NULL);
+
+        // checking builtin commands, excluding them from being included in history
+        // only the first word counts, so fgrep or cdrecord are still recorded
+        size_t first_length = strcspn(line, " ");
+        char first_word[16] = "";
+        if (first_length < sizeof(first_word)) {
+            memcpy(first_word, line, first_length);
+            first_word[first_length] = '\0';
+        }
+        if (!is_shell_builtin(first_word)) {
+            add_to_history(&shell.history, line);
+        }
+        free(line);
+
+        if (parallel_jobs > 0) {
+            run_parallel_line(&shell, &batch, trimmed);
+        } else {
+            execute_line(&shell, trimmed);
+        }
+        free(loop.data);
+    }
+    drain_parallel_batch(&shell, &batch);
+    free_parallel_batch(&batch);
+    if (shell.profile.enabled) {
+        write_profile(&shell.profile);
+        free_profile(&shell.profile);
+    }
+
+    free_shell_variables(&shell.vars);
+    free_history(&shell.history);
+    free_path_cache(&shell.path_cache);
+    free_parse_cache(&shell.parse_cache);
+    free_jobs(&shell);
+    free_line_reader(&input);
+    if (input_fd != STDIN_FILENO) {
+        close(input_fd);
+    }
+    if (shell.child_fd != -1) {
+        close(shell.child_fd);
+    }
+
+    if (shell.had_error) {
+        return -1;
+    }
+    return 0;
+}
+#endif // WSH_NO_MAIN
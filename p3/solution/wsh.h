@@ -2,9 +2,23 @@
 #define WSH_H
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
 #define MAXLINE 1024
-#define MAXARGS 128
 #define DEFAULTHISTORY 5
+#define MAXSTAGES 32
+#define DEFAULTPATHCACHE 64
+#define MAXJOBS 64
+#define MAXPARALLEL 1024
+#define PARALLELRESERVEDFDS 64
+#define DEFAULTVARIABLES 16
+#define LSBATCH 65536
+#define NUMUTILITIES 5
+#define DEFAULTPARSECACHE 64
+#define MAXPARSECACHE 1024
+
+// key stored in slot i of an open addressing table, NULL for an empty slot
+typedef const char *(*SlotKey)(const void *slots, int i);
 
 // shell variable relevant structs
 typedef struct ShellVariable {
@@ -13,31 +27,368 @@ typedef struct ShellVariable {
     struct ShellVariable *next;
 } ShellVariable;
 
+// the list keeps insertion order for vars, the slots index it by name
 typedef struct {
     ShellVariable *head;
+    ShellVariable *tail;
+    ShellVariable **slots; // open addressing, NULL for an empty slot
+    int capacity; // power of two, 0 until the first variable is set
+    int size;
 } ShellVariables;
 
+// growable string with a write cursor at length
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} StringBuffer;
+
 // history command relevant struct
 typedef struct {
-    char **commands;
+    char **commands; // ring buffer, the oldest command is at start
+    int start;
     int size;
     int capacity;
+    int file_fd; // history file opened for appending, -1 without one
+    char *file_path; // set until the history file is loaded
 } History;
 
+// command path cache relevant structs
+typedef struct {
+    char *name; // NULL for an empty slot
+    char *path;
+    int hits;
+} PathCacheEntry;
+
+typedef struct {
+    PathCacheEntry *entries; // open addressing, capacity is a power of two
+    int capacity;
+    int size;
+    long hits;
+    long misses;
+} PathCache;
+
+// a single command with at most one redirection, redirect_type follows the order <, >, >>, &>, &>>, 2>
+typedef struct {
+    char **args; // NULL terminated, grown by add_arg
+    int arg_count;
+    int arg_capacity;
+    char *redirection_file;
+    int redirect_type;
+} Command;
+
+// commands connected with |, all stages run at the same time
+typedef struct {
+    Command stages[MAXSTAGES];
+    int count;
+    int background; // the line ended with &
+} Pipeline;
+
+// syntax tree of a line, words are kept as written and expanded each time the tree runs
+typedef struct {
+    char **words;
+    int word_count;
+    int word_capacity;
+    char *redirection_file;
+    int redirect_type;
+} CommandNode;
+
+typedef struct {
+    CommandNode *stages;
+    int count;
+    int background;
+    int timed; // started with the time prefix
+    char *text; // the pipeline as written without the &, shown by jobs
+} PipelineNode;
+
+typedef enum { NODE_PIPELINE, NODE_FOR, NODE_WHILE } NodeType;
+
+struct Node;
+
+typedef struct {
+    struct Node *nodes;
+    int count;
+    int capacity;
+} NodeList;
+
+// a pipeline, or a loop: for variable in items ; do body ; done, while pipeline ; do body ; done
+typedef struct Node {
+    NodeType type;
+    PipelineNode pipeline; // the command, or the condition of a while loop
+    char *variable;
+    char **items; // points into the tokens of the line
+    int item_count;
+    NodeList body;
+} Node;
+
+// the line split into tokens in place, the nodes point into them
+typedef struct {
+    char *buffer;
+    char **tokens;
+    int token_count;
+    NodeList list;
+} ParsedLine;
+
+typedef struct {
+    char **tokens;
+    int count;
+    int pos;
+    const char *error; // token a syntax error was found near
+} Parser;
+
+typedef struct {
+    char *source; // NULL for an empty slot
+    ParsedLine *parsed;
+} ParseCacheEntry;
+
+// parsed lines by source line, so loops and repeated lines are parsed only once
+typedef struct {
+    ParseCacheEntry *entries; // open addressing, capacity is a power of two
+    int capacity;
+    int size;
+} ParseCache;
+
+// strings made while expanding a tree, freed once it has run
+typedef struct {
+    char **strings;
+    int count;
+    int capacity;
+} StringList;
+
+// a pipeline running in the background, the slot is free when command is NULL
+typedef struct {
+    int id;
+    pid_t pids[MAXSTAGES]; // -1 once a stage is reaped or if it never started
+    int count;
+    int remaining; // stages not reaped yet
+    int stopped;
+    int last_status; // had_error of the last stage
+    pid_t pgid; // process group of the job, 0 if no stage started
+    int order; // the most recently started job is the current one for fg and bg
+    char *command;
+} Job;
+
+// a line of a batch file started with -j, its output is buffered until the lines before it are done
+typedef struct {
+    pid_t pids[MAXSTAGES];
+    int count;
+    int output_fd; // memfd holding stdout
+    int error_fd; // memfd holding stderr
+} ParallelLine;
+
+// lines in flight, a ring with the oldest line at start
+typedef struct {
+    ParallelLine *lines;
+    int capacity;
+    int start;
+    int count;
+} ParallelBatch;
+
+// resource use of the children run with one command name, see WSH_PROFILE
+typedef struct {
+    char *name;
+    double *samples; // wall seconds of each run
+    int count;
+    int capacity;
+    double total; // sum of the samples, filled in when the summary is written
+    double user; // seconds in total
+    double sys;
+    long max_rss; // KiB
+} CommandProfile;
+
+typedef struct {
+    pid_t pid;
+    int command; // index in commands
+    double start;
+    double end; // when the exit was noticed, 0 until then
+} ProfiledChild;
+
+typedef struct {
+    int enabled;
+    char *output_path;
+    CommandProfile *commands;
+    int command_count;
+    int command_capacity;
+    ProfiledChild *children; // started and not reaped yet
+    int child_count;
+    int child_capacity;
+} Profile;
+
+// reads lines from fd through its own buffer, so the shell can poll fd before reading more
+typedef struct {
+    int fd;
+    StringBuffer buffer; // lines not returned yet start at start
+    size_t start;
+    int eof;
+} LineReader;
+
+// state of the shell shared between the main loop and the builtins
+typedef struct {
+    ShellVariables vars;
+    History history;
+    PathCache path_cache;
+    ParseCache parse_cache;
+    Profile profile;
+    Job jobs[MAXJOBS];
+    int job_order;
+    int child_fd; // signalfd for SIGCHLD, -1 without one
+    int child_pending; // a SIGCHLD was read but the jobs were not polled yet
+    int interactive;
+    int disabled_utilities; // bit i turns off utility builtin i, see enable -n
+    int had_error;
+    int status; // exit status of the last command, while loops go on as long as it is 0
+    int depth; // loops being run, the parse cache is only flushed when it is 0
+    int should_exit;
+} Shell;
+
 // function prototypes
 // history functions
 void init_history(History *history, int capacity);
 void free_history(History *history);
+char *history_entry(const History *history, int n);
+void push_history(History *history, const char *command);
 void add_to_history(History *history, const char *command);
+void resize_history(History *history, int capacity);
+char *read_last_line(int fd);
+void open_history_file(History *history, const char *path);
+void load_history(History *history);
 void print_history(const History *history);
 
 // shell variable functions
+const char *variable_key(const void *slots, int i);
+ShellVariable **find_variable_slot(ShellVariables *sv, const char *name);
+void grow_shell_variables(ShellVariables *sv);
 void set_shell_variable(ShellVariables *sv, const char *name, const char *value);
 char *get_shell_variable(ShellVariables *sv, const char *name);
 void free_shell_variables(ShellVariables *sv);
-void substitute_variables(char *command, ShellVariables *sv);
+const char *lookup_variable(ShellVariables *sv, const char *name, size_t length);
+size_t substitution_length(const char *pos);
+void capture_output(Shell *shell, const char *command, StringBuffer *result);
+char *substitute_variables(const char *command, ShellVariables *sv, Shell *shell);
+
+// string buffer functions
+void init_string_buffer(StringBuffer *buffer, size_t capacity);
+void reserve_string(StringBuffer *buffer, size_t length);
+void append_string(StringBuffer *buffer, const char *str, size_t length);
+
+// command path cache functions
+unsigned int hash_string(const char *str);
+int find_slot(const void *slots, int capacity, const char *key, SlotKey key_at);
+void *grow_slots(void *slots, int old_capacity, int capacity, size_t entry_size, SlotKey key_at);
+void init_path_cache(PathCache *cache, int capacity);
+void clear_path_cache(PathCache *cache);
+void free_path_cache(PathCache *cache);
+const char *path_cache_key(const void *entries, int i);
+PathCacheEntry *find_path_cache_slot(PathCache *cache, const char *name);
+char *search_path(const char *name);
+const char *lookup_command(PathCache *cache, const char *name);
+void print_path_cache(const PathCache *cache);
+
+// job control functions
+Job *add_job(Shell *shell, const char *command);
+void free_job(Job *job);
+void update_job_stage(Job *job, int stage, int status);
+void drain_child_signals(Shell *shell);
+void update_jobs(Shell *shell);
+int wait_job(Shell *shell, Job *job);
+void continue_job(Job *job);
+const char *job_state(const Job *job);
+Job *find_job(Shell *shell, const char *spec, const char *builtin);
+void report_jobs(Shell *shell);
+void print_jobs(Shell *shell);
+void free_jobs(Shell *shell);
+
+// resource accounting functions
+double now_seconds(void);
+double timeval_seconds(struct timeval tv);
+void init_profile(Profile *profile, const char *path);
+void profile_child_started(Profile *profile, pid_t pid, const char *name, double start);
+void profile_note_exits(Profile *profile);
+void profile_child_done(Profile *profile, pid_t pid, const struct rusage *usage);
+pid_t reap_child(Shell *shell, pid_t pid, int *status, int options);
+int compare_doubles(const void *a, const void *b);
+int compare_command_profiles(const void *a, const void *b);
+void write_profile(Profile *profile);
+void free_profile(Profile *profile);
+void report_time(double start, const struct rusage *self_before, const struct rusage *children_before);
 
 // built-in implementation functions
+int compare_names(const void *a, const void *b);
 void builtin_ls();
+int utility_index(const char *name);
+int echo_options(const Command *cmd, int *newline);
+int is_integer(const char *str);
+int test_supported(char *const *args, int count);
+int evaluate_test(char *const *args, int count);
+int long_option_only(const Command *cmd);
+int utility_supported(const Command *cmd);
+void builtin_echo(const Command *cmd);
+int copy_to_stdout(int fd);
+int builtin_cat(const Command *cmd);
+int is_shell_builtin(const char *name);
+int is_builtin(Shell *shell, const Command *cmd);
+int run_builtin(Shell *shell, Command *cmd);
+void run_builtin_in_shell(Shell *shell, Command *cmd);
+
+// parsing and execution functions
+void init_command(Command *cmd);
+void add_arg(Command *cmd, char *arg);
+void free_pipeline(Pipeline *pipeline);
+char **tokenize(char *buffer, int *count);
+const char *peek_token(const Parser *parser);
+int is_separator(const char *token);
+int syntax_error(Parser *parser);
+CommandNode *add_stage(PipelineNode *node);
+void add_word(CommandNode *cmd, char *word);
+char *join_tokens(char **tokens, int count);
+int parse_pipeline(Parser *parser, PipelineNode *node);
+int parse_body(Parser *parser, Node *node);
+int parse_node(Parser *parser, Node *node);
+int parse_list(Parser *parser, NodeList *list, const char *end);
+ParsedLine *parse_line(const char *source, char **error);
+void free_pipeline_node(PipelineNode *node);
+void free_node_list(NodeList *list);
+void free_parsed_line(ParsedLine *parsed);
+void init_parse_cache(ParseCache *cache, int capacity);
+void clear_parse_cache(ParseCache *cache);
+void free_parse_cache(ParseCache *cache);
+const char *parse_cache_key(const void *entries, int i);
+ParseCacheEntry *find_parse_cache_slot(ParseCache *cache, const char *source);
+ParsedLine *parse_cached(Shell *shell, const char *source, char **error);
+int has_loop(Shell *shell, const char *line);
+int loop_balance(const char *line);
+int open_redirection(const Command *cmd);
+int redirection_targets(int redirect_type, int targets[2]);
+void exec_command(Command *cmd, const char *path);
+pid_t spawn_command(Command *cmd, const char *path, int input_fd, int output_fd, int redirect_fd, pid_t pgid);
+pid_t fork_command(Shell *shell, Command *cmd, int builtin, const char *path, int input_fd, int output_fd, int redirect_fd, pid_t pgid);
+pid_t start_pipeline(Shell *shell, Pipeline *pipeline, pid_t pids[], int job);
+void wait_pipeline(Shell *shell, pid_t pids[], int count);
+void run_background(Shell *shell, Pipeline *pipeline, const char *source);
+char *keep_string(StringList *list, char *str);
+void free_string_list(StringList *list);
+void expand_word(Shell *shell, const char *word, int split, StringList *fields);
+int expand_pipeline(Shell *shell, const PipelineNode *node, Pipeline *pipeline, StringList *expanded);
+void run_pipeline_node(Shell *shell, const PipelineNode *node);
+void execute_node(Shell *shell, const Node *node);
+void execute_list(Shell *shell, const NodeList *list);
+
+// parallel batch mode functions
+void init_parallel_batch(ParallelBatch *batch, int capacity);
+void free_parallel_batch(ParallelBatch *batch);
+void copy_output(int from_fd, int to_fd);
+void finish_parallel_line(Shell *shell, ParallelBatch *batch);
+void drain_parallel_batch(Shell *shell, ParallelBatch *batch);
+int open_line_buffers(int fds[4]);
+int max_parallel_lines(void);
+void run_parallel_line(Shell *shell, ParallelBatch *batch, const char *line);
+void execute_line(Shell *shell, const char *line);
+
+
+// input functions
+void init_line_reader(LineReader *reader, int fd);
+void free_line_reader(LineReader *reader);
+void wait_for_input(Shell *shell, int fd);
+char *read_line(Shell *shell, LineReader *reader);
 
 #endif // WSH_H
\ No newline at end of file
@@ -0,0 +1,6 @@
+#!/bin/sh
+# stops itself like a job sent ^Z, then tells how wsh started it
+kill -STOP $$
+[ "$(ps -o pgid= -p $$)" != "$(ps -o pgid= -p $PPID)" ] && echo own process group
+[ "$(readlink /proc/$$/fd/0)" = /dev/null ] && echo stdin is /dev/null
+echo resumed